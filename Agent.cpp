@@ -1,18 +1,49 @@
 #include "Agent.h"
 
-Agent::Agent()
+#include <cmath>
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <stdexcept>
+
+static const std::array<std::string, 2> weightsPath = { "weights.bin", "weights2.bin" };
+
+Agent::Agent(size_t gridSize) :
+	mGridSize(gridSize)
 {
 	/*Q.addLayer(32, 4, 4, 1, 2, 0);
 	Q.addLayer(32, 2, 2, 32, 1, 0);
 	Q.addLayer(128, 3, 3, 32, 1, 0);
 	Q.addLayer(4, 1, 1, 128, 1, 0);*/
 	
-	Q.addLayer(16, 3, 3, 1, 1, 0);
-	Q.addLayer(32, 3, 3, 16, 1, 0);
-	Q.addLayer(64, 4, 4, 32, 1, 0);
-	Q.addLayer(128, 1, 1, 64, 1, 0);
-	Q.addLayer(256, 1, 1, 128, 1, 0);
-	Q.addLayer(4, 1, 1, 256, 1, 0);
+	addLayers(Q, mGridSize);
+}
+
+void Agent::addLayers(Network& network, size_t gridSize)
+{
+	if (gridSize == PolicyNetwork::inputHeight) {
+		PolicyNetwork::addLayers(network);
+		return;
+	}
+
+	// 3x3 features at full resolution, then 4x4 kernels with a stride of 2 and a padding of 1, each one halving the map and doubling the channels up to 64
+	size_t size(gridSize), channels(16);
+	network.addLayer(channels, 3, 3, 1, 1, 1);
+
+	while (size > 8) {
+		size_t kernels(std::min<size_t>(2 * channels, 64));
+
+		network.addLayer(kernels, 4, 4, channels, 2, 1);
+		size = (size - 2) / 2 + 1;
+		channels = kernels;
+	}
+
+	network.addLayer(128, size, size, channels, 1, 0);
+	network.addLayer(256, 1, 1, 128, 1, 0);
+	network.addLayer(4, 1, 1, 256, 1, 0);
 }
 
 Direction Agent::optimalAction(const Tensor3D& state, std::vector<Tensor3D>& tensorStack) const
@@ -28,192 +59,804 @@ Direction Agent::optimalAction(const Tensor3D& state, std::vector<Tensor3D>& ten
 	return Direction(iMax);
 }
 
+// Forward the whole batch at once, every tensor of tensorStack holds the activations of all the samples
+std::vector<Direction> Agent::optimalActions(const Tensor3D& states, std::vector<Tensor3D>& tensorStack) const
+{
+	tensorStack = Q.forward(states);
+
+	std::vector<Direction> actions(states.batch());
+
+	for (size_t p(0); p < states.batch(); ++p) {
+		size_t iMax(0);
+
+		for (size_t i(0); i < tensorStack.back().depth(); ++i)
+			if (tensorStack.back()(0, 0, i, p) > tensorStack.back()(0, 0, iMax, p))
+				iMax = i;
+
+		actions[p] = Direction(iMax);
+	}
+
+	return actions;
+}
+
+// Q-values of a batch, one column per sample : they are the first position of each channel of the output
+static Network::Matrix qValues(const Tensor3D& output)
+{
+	size_t channelSize(output.height() * output.width());
+
+	return Eigen::Map<const Network::Matrix, 0, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>>(output.data(), output.depth(), output.batch(),
+																								 Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>(output.depth() * channelSize, channelSize));
+}
+
+// Inference only, nothing is allocated once the workspace has grown
+Direction Agent::optimalAction(const Tensor3D& state, Network::Workspace& workspace) const
+{
+	return _greedyAction(Q, state, workspace);
+}
+
+Direction Agent::_greedyAction(const Network& network, const Tensor3D& state, Network::Workspace& workspace)
+{
+	const Tensor3D& output(network.predict(state, workspace));
+	size_t iMax(0);
+
+	for (size_t i(0); i < output.depth(); ++i)
+		if (output(0, 0, i) > output(0, 0, iMax))
+			iMax = i;
+
+	return Direction(iMax);
+}
+
+// The Q-values are the first position of each channel of the output
+Direction Agent::_greedyAction(const PolicyNetwork& network, const Tensor3D& state, PolicyNetwork::Workspace& workspace)
+{
+	const Real* output(network.predict(state, workspace));
+	size_t channelSize(PolicyNetwork::outputHeight * PolicyNetwork::outputWidth), iMax(0);
+
+	for (size_t i(0); i < PolicyNetwork::outputDepth; ++i)
+		if (output[i * channelSize] > output[iMax * channelSize])
+			iMax = i;
+
+	return Direction(iMax);
+}
+
+static EvaluationReport::Distribution distribution(std::vector<double> values)
+{
+	EvaluationReport::Distribution d = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+
+	if (values.empty())
+		return d;
+
+	std::sort(values.begin(), values.end());
+
+	// Nearest rank
+	auto percentile = [&](double p) { return values[size_t(std::ceil(p * values.size())) - 1]; };
+
+	d.mean = std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+	d.min = values.front();
+	d.p50 = percentile(0.5);
+	d.p90 = percentile(0.9);
+	d.p99 = percentile(0.99);
+	d.max = values.back();
+
+	return d;
+}
+
+// Each thread takes the next game to play until there is none left, so that long games do not hold back the others
+EvaluationReport Agent::evaluate(const EvaluationSettings& settings) const
+{
+	ThreadPool pool(settings.nbThreads ? settings.nbThreads : std::max<size_t>(1, std::thread::hardware_concurrency()));
+	std::vector<double> scores(settings.nbGames), lengths(settings.nbGames);
+	std::atomic<size_t> nextGame(0);
+
+	// Q does not change during the evaluation, a single static copy serves every thread
+	std::unique_ptr<PolicyNetwork> policy(_hasPolicyNetwork() ? new PolicyNetwork(Q) : nullptr);
+
+	// Game g is played with stream g, so the games are the same whatever the number of threads
+	Random random;
+	std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+
+	pool.run(pool.size(), [&](size_t) {
+		Network::Workspace workspace(policy ? Network::Workspace() : Q.workspace(mGridSize, mGridSize));
+		PolicyNetwork::Workspace policyWorkspace;
+		Tensor3D state;
+
+		for (size_t g(nextGame++); g < settings.nbGames; g = nextGame++) {
+			Game game(static_cast<int>(mGridSize), random.stream(g));
+			size_t steps(0);
+
+			while (!game.isFinished() && (!settings.truncate || steps < _stepLimit(game.score()))) {
+				game.state(state);
+				game.nextState(policy ? _greedyAction(*policy, state, policyWorkspace) : optimalAction(state, workspace));
+				++steps;
+			}
+
+			scores[g] = game.score();
+			lengths[g] = double(steps);
+		}
+	});
+
+	EvaluationReport report;
+
+	report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	report.games = settings.nbGames;
+	report.decisions = size_t(std::accumulate(lengths.begin(), lengths.end(), 0.0));
+	report.scores = distribution(scores);
+	report.lengths = distribution(lengths);
+
+	return report;
+}
+
+double EvaluationReport::gamesPerSecond() const
+{
+	return games / seconds;
+}
+
+double EvaluationReport::decisionsPerSecond() const
+{
+	return decisions / seconds;
+}
+
+void EvaluationReport::print(std::ostream& output) const
+{
+	auto json = [&](const char* name, const Distribution& d) {
+		output << "\"" << name << "\": {\"mean\": " << d.mean << ", \"min\": " << d.min << ", \"p50\": " << d.p50
+			   << ", \"p90\": " << d.p90 << ", \"p99\": " << d.p99 << ", \"max\": " << d.max << "}";
+	};
+
+	output << "{\"games\": " << games << ", \"decisions\": " << decisions << ", \"seconds\": " << seconds << ", ";
+	json("score", scores);
+	output << ", ";
+	json("length", lengths);
+	output << ", \"games_per_s\": " << gamesPerSecond() << ", \"decisions_per_s\": " << decisionsPerSecond() << "}" << std::endl;
+}
+
 void Agent::train(size_t nbEpisodes, size_t batchSize, size_t replayMemorySize, double discountFactor, double epsStart, double epsEnd, double epsDecay, double learningRate, double momentumTerm, double smoothingTerm)
 {
-	Game game(10);
+	TrainingSettings settings;
+
+	settings.nbEpisodes = nbEpisodes;
+	settings.batchSize = batchSize;
+	settings.replayMemorySize = replayMemorySize;
+	settings.discountFactor = discountFactor;
+	settings.epsStart = epsStart;
+	settings.epsEnd = epsEnd;
+	settings.epsDecay = epsDecay;
+	settings.learningRate = learningRate;
+	settings.momentumTerm = momentumTerm;
+	settings.smoothingTerm = smoothingTerm;
+
+	train(settings);
+}
 
-	size_t steps(0), episodes(0);
+size_t Agent::train(const TrainingSettings& settings)
+{
+	Game game(static_cast<int>(mGridSize));
 	int episodeSteps(0);
 
-	std::mt19937 generator(std::random_device{}());
-	std::uniform_real_distribution<double> rand(0.0, 1.0);
-	std::uniform_int_distribution<size_t> randAction(0, 3);
-	std::uniform_int_distribution<size_t> randAgent(0, 1);
+	Random random;
+
+	if (settings.verbose)
+		std::cout << "seed: " << Random::seed() << "\n";
+
+	OptimizerSettings optimizerSettings;
+	optimizerSettings.type = settings.optimizer;
+	optimizerSettings.learningRate = settings.learningRate;
+	optimizerSettings.momentumTerm = settings.momentumTerm;
+	optimizerSettings.beta1 = settings.adamBeta1;
+	optimizerSettings.beta2 = settings.adamBeta2;
+	optimizerSettings.epsilon = settings.smoothingTerm;
 
 	// Double DQN
-	size_t agent = 0;
+	Agent otherAgent(mGridSize);
+	mOptimizer = otherAgent.mOptimizer = Optimizer(optimizerSettings);
 
-	Agent otherAgent;
-	std::array<Agent*, 2> agents = { this, &otherAgent };
-	std::array<std::string, 2> weightsPath = { "weights.txt", "weights2.txt" };
+	size_t replayMemorySize(settings.replayMemoryBytes ? ReplayMemory::capacityFor(settings.replayMemoryBytes / 2, mGridSize, mGridSize) : settings.replayMemorySize);
+
+	if (!replayMemorySize)
+		throw std::invalid_argument("Agent: the replay memory budget cannot hold a single transition");
+
+	if (settings.nbActors && settings.gamesPerActor > 1 && mGridSize * mGridSize > 128)
+		throw std::invalid_argument("Agent: actors can only step games together on grids of at most 128 cells");
 
-	std::array<ReplayMemory, 2> replayMemory{ ReplayMemory(replayMemorySize), ReplayMemory(replayMemorySize) };
+	ReplayMemories replayMemory;
 
-	// Fill the replay memory
 	for (size_t a(0); a < 2; ++a) {
-		for (size_t i(0); i < replayMemorySize; ++i, ++episodeSteps) {
-			Transition* t = new Transition(game, Direction(randAction(generator)));
-			replayMemory[a].push(t, _priority(t->reward, 0.6, 1e-6)); // Mostly snake doing nothing
+		if (settings.replayMemoryPath.empty())
+			replayMemory[a].reset(new ReplayMemory(replayMemorySize));
+		else
+			replayMemory[a].reset(new ReplayMemory(settings.replayMemoryPath + std::to_string(a), replayMemorySize, mGridSize, mGridSize));
+	}
+
+	// Fill the replay memory, unless it was reopened with its transitions
+	for (size_t a(0); a < 2; ++a) {
+		for (size_t i(replayMemory[a]->size() ? replayMemorySize : 0); i < replayMemorySize; ++i, ++episodeSteps) {
+			Transition t(game, Direction(random.uniform(4)));
+			replayMemory[a]->push(t, _priority(t.reward, 0.6, 1e-6)); // Mostly snake doing nothing
 
-			if (t->isTerminal || episodeSteps >= 10 + 30 * game.score()) {
+			if (t.isTerminal || episodeSteps >= _stepLimit(game.score())) {
 				game.initialize();
 				episodeSteps = -1;
 			}
 		}
 	}
 
-	// Start the training
-	while (episodes < nbEpisodes) {
-		Transition* t = new Transition; // Current transition
-		std::vector<Tensor3D> x;
-		double epsilon(epsEnd + (epsStart - epsEnd) * exp(-1.0 * steps * epsDecay));
+	Learner learner(settings.learnerThreads);
+
+	std::ofstream metricsFile;
+
+	if (!settings.metricsPath.empty())
+		metricsFile.open(settings.metricsPath, std::ios::app);
+
+	MetricsWriter metrics(settings.metricsPath.empty() ? std::cout : metricsFile, settings.metricsInterval);
+	Metrics::enable(settings.metricsInterval > 0);
 
-		t->state = Tensor3D(game.state());
+	size_t steps(settings.nbActors ? _trainConcurrent(otherAgent, replayMemory, learner, metrics, settings)
+								   : _trainSerial(otherAgent, replayMemory, learner, metrics, settings));
+
+	Metrics::enable(false);
+
+	return steps;
+}
+
+// One step of the game, then one learner update
+size_t Agent::_trainSerial(Agent& otherAgent, ReplayMemories& replayMemory, Learner& learner, MetricsWriter& metrics, const TrainingSettings& settings)
+{
+	Game game(static_cast<int>(mGridSize));
+	CheckpointWriter checkpoints;
+
+	size_t steps(0), episodes(0);
+	int episodeSteps(0);
+
+	Random random;
+
+	// Double DQN : the agent of an episode pushes its steps to its own replay memory, where they share their frames, and learns from that memory
+	// so that each step it pushes with a big priority is sampled right away
+	size_t agent(random.uniform(2));
+	std::array<Agent*, 2> agents = { this, &otherAgent };
+
+	Network::Workspace workspace(Q.workspace(mGridSize, mGridSize));
+
+	// Start the training
+	while (episodes < settings.nbEpisodes) {
+		Transition t; // Current transition
+		double epsilon(settings.epsEnd + (settings.epsStart - settings.epsEnd) * exp(-1.0 * steps * settings.epsDecay));
 
 		// Select an action to perform (epsilon-greedy policy)
-		if (rand(generator) > epsilon)
-			t->action = optimalAction(t->state, x);
-		else
-			t->action = Direction(randAction(generator));
+		if (random.uniform() > epsilon) {
+			Metrics::Timer timer(Metrics::Act);
+			game.state(t.state);
+			t.action = optimalAction(t.state, workspace);
+		} else {
+			t.action = Direction(random.uniform(4));
+		}
+
+		Metrics::Timer stepTimer(Metrics::EnvStep);
+		t = Transition(game, t.action);
+		stepTimer.stop();
 
-		*t = Transition(game, t->action);
+		Metrics::Timer pushTimer(Metrics::ReplayPush);
+		replayMemory[agent]->push(t, 100.0); // Big priority to ensure it will be sampled immediately
+		pushTimer.stop();
 
-		if (t->isTerminal || episodeSteps >= 10 + 30 * game.score()) {
+		agents[agent]->_learn(*agents[1 - agent], *replayMemory[agent], learner, settings);
+
+		if (t.isTerminal || episodeSteps >= _stepLimit(game.score())) {
 			++episodes;
 			episodeSteps = -1;
-			std::cout << episodes << " / " << nbEpisodes << ": " << game.score() << "\n";
+			if (settings.verbose)
+				std::cout << episodes << " / " << settings.nbEpisodes << ": " << game.score() << "\n";
 
-			agents[0]->saveToFile(weightsPath[0]);
-			agents[1]->saveToFile(weightsPath[1]);
+			_checkpoint(checkpoints, otherAgent, settings);
 			game.initialize();
+			agent = random.uniform(2);
 		}
 
-		replayMemory[agent].push(t, 100.0); // Big priority to ensure it will be sampled immediately
-		std::vector<size_t> batch(replayMemory[agent].sample(batchSize));
+		++steps;
+		++episodeSteps;
 
+		if (settings.metricsInterval > 0 && metrics.isDue())
+			_flushMetrics(metrics, replayMemory);
+	}
 
-		std::vector<std::vector<std::vector<Tensor3D>>> weightsGradients(batch.size());
-		std::vector<std::vector<std::vector<double>>> biasesGradients(batch.size());
+	return steps;
+}
 
-		// Compute gradients for the batch
-		for (size_t i(0); i < batch.size(); ++i) {
-			t = replayMemory[agent][batch[i]].transition;
-			agents[agent]->optimalAction(t->state, x);
+// Actor threads play with the last published snapshot of the weights while the calling thread learns
+size_t Agent::_trainConcurrent(Agent& otherAgent, ReplayMemories& replayMemory, Learner& learner, MetricsWriter& metrics, const TrainingSettings& settings)
+{
+	std::array<Agent*, 2> agents = { this, &otherAgent };
+	CheckpointWriter checkpoints;
+
+	// The snapshot published before the current one is reused once no actor holds it anymore, then publishing only copies the parameters
+	std::shared_ptr<Network> published(std::make_shared<Network>(Q)), previous;
+	std::shared_ptr<const Network> policy(published);
+	std::atomic<size_t> actorSteps(0), episodes(0);
+	std::atomic<bool> stop(false);
+	std::mutex outputMutex;
+
+	// Each actor keeps a static copy of the snapshot it last acted with, the snapshot itself being held so that it is not reused for a later one
+	bool isStatic(_hasPolicyNetwork());
+
+	// The steps of an episode go to one replay memory, pushed together so that the other actors cannot come in between and break their shared frames
+	// Long episodes are pushed every pushSteps steps, for the learner not to wait for them
+	const size_t pushSteps(32);
+
+	// Pushes the nbSteps steps buffered in episode once it ends or they reach pushSteps, the end of an episode being counted and the last one stopping the actors
+	auto record = [&](const std::vector<Transition>& episode, size_t& nbSteps, size_t memory, bool isLast, double score) {
+		if (isLast || nbSteps >= pushSteps) {
+			Metrics::Timer pushTimer(Metrics::ReplayPush);
+			replayMemory[memory]->push(episode.data(), nbSteps, 100.0); // Big priority to ensure it will be sampled immediately
+			pushTimer.stop();
+
+			nbSteps = 0;
+		}
+
+		if (!isLast)
+			return;
 
-			// Compute target vector
-			Eigen::VectorXd target(x.back().depth());
+		size_t episodeCount(++episodes);
 
-			for (size_t i(0); i < x.back().depth(); ++i)
-				target(i) = x.back()(0, 0, i);
+		if (settings.verbose) {
+			std::lock_guard<std::mutex> lock(outputMutex);
+			std::cout << episodeCount << " / " << settings.nbEpisodes << ": " << score << "\n";
+		}
+
+		if (episodeCount >= settings.nbEpisodes)
+			stop = true;
+	};
+
+	// Each actor has its own stream, given before it starts so that it does not depend on the order of the threads
+	auto actor = [&](Random random) {
+		Game game(static_cast<int>(mGridSize), random.stream(0));
+		Network::Workspace workspace(isStatic ? Network::Workspace() : Q.workspace(mGridSize, mGridSize));
+		std::unique_ptr<PolicyNetwork> staticPolicy(isStatic ? new PolicyNetwork() : nullptr);
+		PolicyNetwork::Workspace policyWorkspace;
+		std::shared_ptr<const Network> snapshot;
+		Tensor3D observation;
+		int episodeSteps(0);
+
+		std::vector<Transition> episode(pushSteps);
+		size_t nbSteps(0), memory(random.uniform(2));
+
+		while (!stop) {
+			double epsilon(settings.epsEnd + (settings.epsStart - settings.epsEnd) * exp(-1.0 * actorSteps++ * settings.epsDecay));
+			Direction action;
+
+			// Select an action to perform (epsilon-greedy policy)
+			if (random.uniform() > epsilon) {
+				Metrics::Timer timer(Metrics::Act);
+				game.state(observation);
+
+				if (isStatic) {
+					std::shared_ptr<const Network> latest(std::atomic_load(&policy));
+
+					if (latest != snapshot) {
+						snapshot = latest;
+						staticPolicy->copyParameters(*snapshot);
+					}
 
-			target(t->action) = t->reward;
+					action = _greedyAction(*staticPolicy, observation, policyWorkspace);
+				} else {
+					action = _greedyAction(*std::atomic_load(&policy), observation, workspace);
+				}
+			} else {
+				action = Direction(random.uniform(4));
+			}
 
-			if (!t->isTerminal) {
-				Direction nextAction;
-				std::vector<Tensor3D> nextX;
+			Metrics::Timer stepTimer(Metrics::EnvStep);
+			episode[nbSteps] = Transition(game, action);
+			stepTimer.stop();
 
-				nextAction = agents[agent]->optimalAction(t->nextState);
-				agents[1 - agent]->optimalAction(t->nextState, nextX);
+			bool isLast(episode[nbSteps++].isTerminal || episodeSteps >= _stepLimit(game.score()));
+			record(episode, nbSteps, memory, isLast, game.score());
 
-				target(t->action) += discountFactor * nextX.back()(0, 0, nextAction);
+			if (isLast) {
+				episodeSteps = -1;
+				game.initialize();
+				memory = random.uniform(2);
 			}
 
-			replayMemory[agent].setVal(batch[i], _priority(x.back()(0, 0, t->action) - target(t->action), 0.6, 1e-6)); // Update transition priority
-			agents[agent]->Q.backward(x, target, weightsGradients[i], biasesGradients[i]);
+			++episodeSteps;
 		}
+	};
+
+	// Actor stepping gamesPerActor games together : the greedy actions of all of them come from one batched prediction
+	// VecGame restarts the games that end during a step, those cut by the step limit are restarted here
+	// Each game buffers its steps in transitions allocated once, the states being written into them by VecGame
+	auto vectorActor = [&](Random random) {
+		size_t nbGames(settings.gamesPerActor), sampleSize(mGridSize * mGridSize);
+		VecGame games(nbGames, static_cast<int>(mGridSize), random.stream(0));
+		Network::Workspace workspace(Q.workspace(mGridSize, mGridSize, nbGames));
+		Tensor3D states; // Current state of every game, the input of the batched prediction
+
+		std::vector<Direction> actions(nbGames);
+		std::vector<double> rewards(nbGames), uniforms(nbGames);
+		std::unique_ptr<bool[]> isTerminal(new bool[nbGames]);
+		std::vector<int> episodeSteps(nbGames, 0);
+
+		std::vector<std::vector<Transition>> episodes(nbGames, std::vector<Transition>(pushSteps));
+		std::vector<size_t> nbSteps(nbGames, 0), memories(nbGames);
+
+		for (std::vector<Transition>& episode : episodes) {
+			for (Transition& t : episode) {
+				t.state.resize(mGridSize, mGridSize, 1);
+				t.nextState.resize(mGridSize, mGridSize, 1);
+			}
+		}
+
+		for (size_t& memory : memories)
+			memory = random.uniform(2);
 
-		// Average the gradients
-		std::vector<std::vector<Tensor3D>> weightsGradient(weightsGradients[0]);
-		std::vector<std::vector<double>> biasesGradient(biasesGradients[0]);
+		games.state(states);
 
-		for (size_t l(0); l < weightsGradient.size(); ++l) {
-			size_t kernelHeight = weightsGradient[l][0].height(),
-				   kernelWidth = weightsGradient[l][0].width(),
-				   kernelDepth = weightsGradient[l][0].depth(),
-				   nbKernels = weightsGradient[l].size();
+		while (!stop) {
+			double epsilon(settings.epsEnd + (settings.epsStart - settings.epsEnd) * exp(-1.0 * actorSteps.fetch_add(nbGames) * settings.epsDecay));
+			random.uniforms(uniforms.data(), nbGames);
 
-			for (size_t k(0); k < nbKernels; ++k) {
-				weightsGradient[l][k] = Tensor3D(kernelHeight, kernelWidth, kernelDepth);
-				biasesGradient[l][k] = 0;
+			// Select the actions to perform (epsilon-greedy policy), predicting for the whole batch if any game is greedy
+			if (std::any_of(uniforms.begin(), uniforms.end(), [&](double u) { return u > epsilon; })) {
+				Metrics::Timer timer(Metrics::Act);
+				std::shared_ptr<const Network> network(std::atomic_load(&policy));
+				Network::Matrix q(qValues(network->predict(states, workspace)));
 
-				for (size_t p(0); p < batch.size(); ++p) {
-					biasesGradient[l][k] += biasesGradients[p][l][k] / batch.size();
+				for (size_t g(0); g < nbGames; ++g) {
+					Eigen::Index iMax;
+					q.col(g).maxCoeff(&iMax);
+					actions[g] = Direction(iMax);
+				}
+			}
+
+			for (size_t g(0); g < nbGames; ++g)
+				if (uniforms[g] <= epsilon)
+					actions[g] = Direction(random.uniform(4));
+
+			Metrics::Timer stepTimer(Metrics::EnvStep);
+			games.step(actions.data(), rewards.data(), isTerminal.get());
+
+			for (size_t g(0); g < nbGames; ++g) {
+				Transition& t(episodes[g][nbSteps[g]]);
+
+				std::copy_n(states.data() + g * sampleSize, sampleSize, t.state.data());
+				games.state(g, t.nextState.data());
+				t.action = actions[g];
+				t.reward = rewards[g];
+				t.isTerminal = isTerminal[g];
+			}
+
+			stepTimer.stop();
 
-					for (size_t m(0); m < kernelHeight; ++m)
-						for (size_t n(0); n < kernelWidth; ++n)
-							for (size_t c(0); c < kernelDepth; ++c)
-								weightsGradient[l][k](m, n, c) += weightsGradients[p][l][k](m, n, c) / batch.size();
+			for (size_t g(0); g < nbGames; ++g) {
+				const Transition& t(episodes[g][nbSteps[g]++]);
+				double score(t.isTerminal ? games.finalScore(g) : games.score(g));
+				bool isLast(t.isTerminal || episodeSteps[g] >= _stepLimit(score));
+
+				// The next state of a terminal step is already the state of the restarted game
+				if (isLast && !t.isTerminal) {
+					games.reset(g);
+					games.state(g, states.data() + g * sampleSize);
+				} else {
+					std::copy_n(t.nextState.data(), sampleSize, states.data() + g * sampleSize);
+				}
+
+				record(episodes[g], nbSteps[g], memories[g], isLast, score);
+
+				if (isLast) {
+					episodeSteps[g] = -1;
+					memories[g] = random.uniform(2);
 				}
+
+				++episodeSteps[g];
 			}
 		}
+	};
 
-		agents[agent]->Q.applyGradient(weightsGradient, biasesGradient, learningRate, momentumTerm, smoothingTerm);
-		++steps;
-		++episodeSteps;
+	std::vector<std::thread> actors;
+	Random random;
 
-		agent = randAgent(generator);
+	for (size_t i(0); i < settings.nbActors; ++i) {
+		if (settings.gamesPerActor > 1)
+			actors.emplace_back(vectorActor, random.stream(i));
+		else
+			actors.emplace_back(actor, random.stream(i));
 	}
+
+	size_t updates(0), lastSteps(0), lastUpdates(0);
+	std::chrono::steady_clock::time_point lastReport(std::chrono::steady_clock::now());
+
+	while (!stop) {
+		// Never go past the replay ratio, the actors are never waited for
+		if (updates >= settings.replayRatio * actorSteps) {
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		} else {
+			size_t agent(random.uniform(2));
+			agents[agent]->_learn(*agents[1 - agent], *replayMemory[agent], learner, settings);
+
+			if (++updates % settings.publishInterval == 0)
+				std::atomic_store(&policy, std::shared_ptr<const Network>(_publish(published, previous)));
+		}
+
+		double elapsed(std::chrono::duration<double>(std::chrono::steady_clock::now() - lastReport).count());
+
+		// Report the throughput and checkpoint both agents
+		if (elapsed >= settings.reportInterval) {
+			size_t steps(actorSteps);
+
+			if (settings.verbose) {
+				std::lock_guard<std::mutex> lock(outputMutex);
+				std::cout << "actors: " << (steps - lastSteps) / elapsed << " steps/s, learner: " << (updates - lastUpdates) / elapsed << " updates/s\n";
+			}
+
+			_checkpoint(checkpoints, otherAgent, settings);
+
+			lastSteps = steps;
+			lastUpdates = updates;
+			lastReport = std::chrono::steady_clock::now();
+		}
+
+		if (settings.metricsInterval > 0 && metrics.isDue())
+			_flushMetrics(metrics, replayMemory);
+	}
+
+	for (std::thread& t : actors)
+		t.join();
+
+	_checkpoint(checkpoints, otherAgent, settings);
+
+	return actorSteps;
 }
 
-void Agent::saveToFile(const std::string& path) const
+// Actors can only take the current snapshot, so once they have all released the previous one it is free
+std::shared_ptr<Network> Agent::_publish(std::shared_ptr<Network>& published, std::shared_ptr<Network>& previous) const
 {
-	std::ofstream file;
-	file.open(path, std::fstream::trunc);
+	std::shared_ptr<Network> snapshot(std::move(previous));
 
-	int kernelHeight(0), kernelWidth(0), kernelDepth(0);
+	if (snapshot && snapshot.use_count() == 1) {
+		std::atomic_thread_fence(std::memory_order_acquire); // The actors are done reading it
+		snapshot->copyParameters(Q);
+	} else {
+		snapshot = std::make_shared<Network>(Q);
+	}
 
-	for (int l(0); l < Q.layers(); ++l) {
-		kernelHeight = Q.layer(l).kernels[0].weights.height();
-		kernelWidth = Q.layer(l).kernels[0].weights.width();
-		kernelDepth = Q.layer(l).kernels[0].weights.depth();
+	previous = std::move(published);
+	published = snapshot;
 
-		file << Q.layer(l).stride << "\n";
-		file << Q.layer(l).padding << "\n";
+	return snapshot;
+}
 
-		for (int k(0); k < Q.layer(l).kernels.size(); ++k) {
-			for (int m(0); m < kernelHeight; ++m) {
-				for (int n(0); n < kernelWidth; ++n) {
-					for (int c(0); c < kernelDepth; ++c) {
-						file << Q.layer(l).kernels[k].weights(m, n, c) << "\n";
-					}
-				}
-			}
+Agent::Learner::Learner(size_t nbThreads) :
+	pool(std::max<size_t>(nbThreads, 1)),
+	gradients(pool.size()),
+	workspaces(pool.size())
+{
+}
 
-			file << Q.layer(l).kernels[k].bias << "\n";
+// One update of this agent on a batch of its replay memory, the other agent evaluates the next states (Double DQN)
+// The batch is split between the threads of the learner, each one accumulating the gradient of its part, then the gradients are summed pairwise
+void Agent::_learn(const Agent& other, ReplayMemory& replayMemory, Learner& learner, const TrainingSettings& settings)
+{
+	Metrics::Timer sampleTimer(Metrics::ReplaySample);
+	TransitionBatch batch;
+	replayMemory.sample(settings.batchSize, batch);
+	sampleTimer.stop();
+
+	size_t nbParts(std::min(learner.pool.size(), settings.batchSize));
+	std::vector<double> priorities(settings.batchSize);
+
+	learner.pool.run(nbParts, [&](size_t part) {
+		size_t first(part * settings.batchSize / nbParts),
+			   count((part + 1) * settings.batchSize / nbParts - first);
+
+		Metrics::Timer forwardTimer(Metrics::Forward);
+
+		// Forward the samples of this part in a single pass
+		std::vector<Tensor3D> batchStack(Q.forward(batch.states.samples(first, count)));
+
+		Network::Matrix values(qValues(batchStack.back())), targets(values);
+		Network::Vector targetValues(_targetValues(other, batch, first, count, settings.discountFactor, learner.workspaces[part])),
+						tdErrors(count);
+
+		// The target vectors are the outputs of the network except for the action played, one column per sample
+		for (size_t i(0); i < count; ++i) {
+			targets(batch.actions[first + i], i) = targetValues(i);
+			tdErrors(i) = values(batch.actions[first + i], i) - targetValues(i);
 		}
+
+		Eigen::Map<Eigen::ArrayXd>(priorities.data() + first, count) = (tdErrors.cast<double>().array().abs() + 1e-6).pow(0.6);
+
+		forwardTimer.stop();
+
+		// Gradient of the loss averaged over the whole batch
+		Metrics::Timer backwardTimer(Metrics::Backward);
+		Q.backward(batchStack, targets, learner.gradients[part], settings.batchSize);
+	});
+
+	// Tree reduction : at each level, the accumulator of every pair receives the sum of both
+	Metrics::Timer reductionTimer(Metrics::GradientReduction);
+
+	for (size_t stride(1); stride < nbParts; stride *= 2) {
+		learner.pool.run((nbParts + 2 * stride - 1) / (2 * stride), [&](size_t pair) {
+			size_t i(2 * stride * pair);
+
+			if (i + stride < nbParts)
+				learner.gradients[i] += learner.gradients[i + stride];
+		});
+	}
+
+	reductionTimer.stop();
+
+	Metrics::Timer updateTimer(Metrics::ReplayUpdate);
+	replayMemory.setVals(batch, priorities); // Update transitions priorities
+	updateTimer.stop();
+
+	Metrics::Timer applyTimer(Metrics::ApplyGradient);
+	Q.applyGradient(learner.gradients[0], mOptimizer);
+}
+
+// Double DQN targets of the samples first ... first + count - 1 : the online network picks the next action and the other agent evaluates it
+// The non-terminal next states are gathered so that each network sees them in a single batched pass
+Network::Vector Agent::_targetValues(const Agent& other, const TransitionBatch& batch, size_t first, size_t count, double discountFactor, Network::Workspace& workspace) const
+{
+	Network::Vector targetValues(count);
+	std::vector<size_t> nonTerminal;
+
+	for (size_t i(0); i < count; ++i) {
+		targetValues(i) = batch.rewards[first + i];
+
+		if (!batch.isTerminal[first + i])
+			nonTerminal.push_back(i);
 	}
+
+	if (nonTerminal.empty())
+		return targetValues;
+
+	size_t sampleSize(batch.nextStates.sampleSize());
+	Tensor3D nextStates(batch.nextStates.height(), batch.nextStates.width(), batch.nextStates.depth(), nonTerminal.size());
+
+	for (size_t j(0); j < nonTerminal.size(); ++j)
+		std::copy_n(batch.nextStates.data() + (first + nonTerminal[j]) * sampleSize, sampleSize, nextStates.data() + j * sampleSize);
+
+	// The workspace is reused by the second pass, so the next actions are taken first
+	Network::Matrix nextValues(qValues(Q.predict(nextStates, workspace)));
+	std::vector<Eigen::Index> nextActions(nonTerminal.size());
+
+	for (size_t j(0); j < nonTerminal.size(); ++j)
+		nextValues.col(j).maxCoeff(&nextActions[j]);
+
+	Network::Matrix otherValues(qValues(other.Q.predict(nextStates, workspace)));
+
+	for (size_t j(0); j < nonTerminal.size(); ++j)
+		targetValues(nonTerminal[j]) += discountFactor * otherValues(nextActions[j], j);
+
+	return targetValues;
 }
 
+const Network& Agent::network() const
+{
+	return Q;
+}
+
+size_t Agent::gridSize() const
+{
+	return mGridSize;
+}
+
+bool Agent::_hasPolicyNetwork() const
+{
+	return mGridSize == PolicyNetwork::inputHeight && PolicyNetwork::matches(Q);
+}
+
+// Episodes are cut after gridSize * (1 + 3 * score) steps, 10 + 30 * score on 10x10 grids
+double Agent::_stepLimit(double score) const
+{
+	return mGridSize * (1.0 + 3.0 * score);
+}
+
+void Agent::saveToFile(const std::string& path) const
+{
+	Checkpoint::save(Q, path);
+}
+
+static bool sameLayers(const Network& a, const Network& b)
+{
+	if (a.layers() != b.layers())
+		return false;
+
+	for (size_t l(0); l < a.layers(); ++l) {
+		const Layer& x(a.layer(l));
+		const Layer& y(b.layer(l));
+
+		if (x.weights.height() != y.weights.height() || x.weights.width() != y.weights.width() || x.weights.depth() != y.weights.depth()
+			|| x.weights.batch() != y.weights.batch() || x.stride != y.stride || x.padding != y.padding)
+			return false;
+	}
+
+	return true;
+}
+
+// Binary checkpoints are mapped in memory, text files are those written before the binary format
+// A binary checkpoint must have the layers of the agent, which depend on the grid size, so that it is never played on another grid
 void Agent::loadFromFile(const std::string& path)
 {
+	if (Checkpoint::isBinary(path)) {
+		Network network(Checkpoint::load(path));
+
+		if (!sameLayers(network, Q))
+			throw std::invalid_argument("Agent: " + path + " does not have the layers of a " + std::to_string(mGridSize) + "x" + std::to_string(mGridSize) + " agent");
+
+		Q.swap(network);
+		return;
+	}
+
 	std::ifstream file;
 	file.open(path);
 
+	if (!file.is_open())
+		throw std::runtime_error("Agent: cannot open " + path);
+
+	// Text checkpoints are read into a copy, so that the agent keeps its weights if the file is not one of them
+	Network network(Q);
 	int kernelHeight(0), kernelWidth(0), kernelDepth(0);
 
-	for (int l(0); l < Q.layers(); ++l) {
-		kernelHeight = Q.layer(l).kernels[0].weights.height();
-		kernelWidth = Q.layer(l).kernels[0].weights.width();
-		kernelDepth = Q.layer(l).kernels[0].weights.depth();
+	for (size_t l(0); l < network.layers(); ++l) {
+		kernelHeight = network.layer(l).weights.height();
+		kernelWidth = network.layer(l).weights.width();
+		kernelDepth = network.layer(l).weights.depth();
 
-		file >> Q.layer(l).stride;
-		file >> Q.layer(l).padding;
+		file >> network.layer(l).stride;
+		file >> network.layer(l).padding;
 
-		for (int k(0); k < Q.layer(l).kernels.size(); ++k) {
+		for (size_t k(0); k < network.layer(l).weights.batch(); ++k) {
 			for (int m(0); m < kernelHeight; ++m) {
 				for (int n(0); n < kernelWidth; ++n) {
 					for (int c(0); c < kernelDepth; ++c) {
-						file >> Q.layer(l).kernels[k].weights(m, n, c);
+						file >> network.layer(l).weights(m, n, c, k);
 					}
 				}
 			}
 
-			file >> Q.layer(l).kernels[k].bias;
+			file >> network.layer(l).biases(k);
 		}
 	}
+
+	// Numbers left over mean the checkpoint is for a larger agent
+	file >> std::ws;
+
+	if (!file || !file.eof())
+		throw std::runtime_error("Agent: " + path + " is not a checkpoint of a " + std::to_string(mGridSize) + "x" + std::to_string(mGridSize) + " agent");
+
+	Q.swap(network);
+}
+
+// Asynchronous save of both agents
+void Agent::_checkpoint(CheckpointWriter& checkpoints, const Agent& otherAgent, const TrainingSettings& settings) const
+{
+	if (!settings.checkpoints)
+		return;
+
+	Metrics::Timer timer(Metrics::Checkpointing);
+
+	checkpoints.save(Q, weightsPath[0]);
+	checkpoints.save(otherAgent.Q, weightsPath[1]);
 }
 
 double Agent::_priority(double p, double alpha, double epsilon)
 {
 	return std::pow(std::abs(p) + epsilon, alpha);
 }
+
+// Throughput of every phase, with the fill level and the total priority of both replay memories
+void Agent::_flushMetrics(MetricsWriter& metrics, const ReplayMemories& replayMemory)
+{
+	std::vector<std::pair<std::string, double>> gauges;
+
+	for (size_t a(0); a < 2; ++a) {
+		size_t size(replayMemory[a]->size());
+		std::string suffix("_" + std::to_string(a));
+
+		gauges.push_back({ "replay_size" + suffix, double(size) });
+		gauges.push_back({ "replay_fill" + suffix, double(size) / replayMemory[a]->capacity() });
+		gauges.push_back({ "priority_sum" + suffix, replayMemory[a]->totalPriority() });
+	}
+
+	metrics.flush(gauges);
+}
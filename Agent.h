@@ -2,29 +2,157 @@
 #define AGENT_H
 
 #include "Network.h"
+#include "StaticNetwork.h"
 #include "Game.h"
+#include "VecGame.h"
 #include "ReplayMemory.h"
+#include "Checkpoint.h"
+#include "ThreadPool.h"
+#include "Metrics.h"
 
 #include <array>
+#include <memory>
 #include <string>
 #include <fstream>
 #include <iostream>
 
+struct TrainingSettings
+{
+	size_t nbEpisodes = size_t(-1);
+	size_t batchSize = 16;
+	size_t replayMemorySize = 262144;
+	size_t replayMemoryBytes = 0; // Budget of both replay memories together, when it is not 0 their size follows from it and from the grid size instead
+	std::string replayMemoryPath; // When set, the replay memories are the files replayMemoryPath0 and replayMemoryPath1, reopened by the next training
+	double discountFactor = 0.99;
+	double epsStart = 1.0;
+	double epsEnd = 0.01;
+	double epsDecay = 0.0005;
+	double learningRate = 0.00025;
+	double momentumTerm = 0.95;
+	double smoothingTerm = 1e-8;
+
+	// RMSProp uses momentumTerm and smoothingTerm, Adam uses adamBeta1, adamBeta2 and smoothingTerm
+	OptimizerType optimizer = OptimizerType::RMSProp;
+	double adamBeta1 = 0.9;
+	double adamBeta2 = 0.999;
+
+	// Actor threads, each one playing its own game with a snapshot of the weights
+	// With 0 actors, acting and learning alternate on the calling thread
+	size_t nbActors = 0;
+	size_t gamesPerActor = 1; // Above 1, each actor steps that many games together through VecGame (grids of at most 128 cells) with batched predictions
+	double replayRatio = 1.0; // Maximum number of learner updates per actor step
+	size_t publishInterval = 100; // Learner updates between two snapshots of the weights
+	double reportInterval = 10.0; // Seconds between two throughput reports
+
+	// Threads computing the gradient of a batch, each one on its own part of the batch
+	size_t learnerThreads = 1;
+
+	bool verbose = true; // Print the score of every episode and the throughput reports
+	bool checkpoints = true; // Save both agents during the training
+
+	// Seconds between two lines of metrics, 0 disables them
+	// The lines are appended to metricsPath, or written to the standard output if it is empty
+	double metricsInterval = 0.0;
+	std::string metricsPath;
+};
+
+struct EvaluationSettings
+{
+	size_t nbGames = 1000;
+	size_t nbThreads = 0; // 0 for every core
+
+	// Greedy policies can loop forever, so a game ends like a training episode after gridSize * (1 + 3 * score) steps
+	bool truncate = true;
+};
+
+// Scores and episode lengths are given as mean, minimum, percentiles and maximum
+struct EvaluationReport
+{
+	struct Distribution
+	{
+		double mean, min, p50, p90, p99, max;
+	};
+
+	size_t games;
+	size_t decisions;
+	double seconds;
+
+	Distribution scores;
+	Distribution lengths;
+
+	double gamesPerSecond() const;
+	double decisionsPerSecond() const;
+
+	// One JSON object on one line, like the benchmarks
+	void print(std::ostream&) const;
+};
+
+// Architecture of the agents on the 10x10 single-channel states of the game
+// Inference runs on this static network whenever the grid is 10x10 and the network has these layers, and on the runtime one otherwise
+typedef BasicStaticNetwork<Real, 10, 10, 1,
+						   StaticLayer<16, 3, 3>,
+						   StaticLayer<32, 3, 3>,
+						   StaticLayer<64, 4, 4>,
+						   StaticLayer<128, 1, 1>,
+						   StaticLayer<256, 1, 1>,
+						   StaticLayer<4, 1, 1>> PolicyNetwork;
+
 class Agent
 {
 public:
-	Agent();
+	// The states are gridSize x gridSize, the architecture depends on it
+	Agent(size_t = PolicyNetwork::inputHeight);
 
 	Direction optimalAction(const Tensor3D&, std::vector<Tensor3D>& = std::vector<Tensor3D>()) const;
+	Direction optimalAction(const Tensor3D&, Network::Workspace&) const;
+	std::vector<Direction> optimalActions(const Tensor3D&, std::vector<Tensor3D>&) const;
 	void train(size_t, size_t, size_t, double, double, double, double, double, double, double);
+	size_t train(const TrainingSettings&); // Returns the number of steps played after filling the replay memories
+
+	// Greedy games without exploration nor learning, played in parallel
+	EvaluationReport evaluate(const EvaluationSettings&) const;
+
+	const Network& network() const;
+	size_t gridSize() const;
+
+	// Layers of the agents for a grid size : PolicyNetwork for 10x10 grids, otherwise stride-2 convolutions halve the grid
+	// down to at most 8x8 before a layer covering the whole map, so that the cost of the network grows with the grid and not its shape
+	static void addLayers(Network&, size_t);
 
 	void saveToFile(const std::string&) const;
 	void loadFromFile(const std::string&);
 
 private:
+	typedef std::array<std::unique_ptr<ReplayMemory>, 2> ReplayMemories;
+
+	// Thread pool of the learner and one gradient accumulator per thread, shared by both agents
+	struct Learner
+	{
+		Learner(size_t);
+
+		ThreadPool pool;
+		std::vector<Network::Vector> gradients;
+		std::vector<Network::Workspace> workspaces;
+	};
+
+	size_t _trainSerial(Agent&, ReplayMemories&, Learner&, MetricsWriter&, const TrainingSettings&);
+	size_t _trainConcurrent(Agent&, ReplayMemories&, Learner&, MetricsWriter&, const TrainingSettings&);
+	void _learn(const Agent&, ReplayMemory&, Learner&, const TrainingSettings&);
+	Network::Vector _targetValues(const Agent&, const TransitionBatch&, size_t, size_t, double, Network::Workspace&) const;
+	void _checkpoint(CheckpointWriter&, const Agent&, const TrainingSettings&) const;
+	std::shared_ptr<Network> _publish(std::shared_ptr<Network>&, std::shared_ptr<Network>&) const;
+	static void _flushMetrics(MetricsWriter&, const ReplayMemories&);
+
+	static Direction _greedyAction(const Network&, const Tensor3D&, Network::Workspace&);
+	static Direction _greedyAction(const PolicyNetwork&, const Tensor3D&, PolicyNetwork::Workspace&);
 	double _priority(double, double, double);
 
+	bool _hasPolicyNetwork() const;
+	double _stepLimit(double) const;
+
+	size_t mGridSize;
 	Network Q;
+	Optimizer mOptimizer;
 };
 
 #endif // AGENT_H
@@ -0,0 +1,412 @@
+#include "Benchmark.h"
+#include "Agent.h"
+
+#include <cstdio>
+#include <thread>
+#include <memory>
+#include <sstream>
+
+// Results are accumulated here so that the compiler cannot drop the benchmarked calls
+static volatile double sink(0.0);
+
+Benchmark::Benchmark(std::ostream& output, double minTime) :
+	mOutput(output),
+	mMinTime(minTime)
+{
+}
+
+void Benchmark::record(const std::string& name, const std::string& params, size_t ops, double seconds)
+{
+	mOutput << "{\"benchmark\": \"" << name << "\", \"params\": \"" << params << "\", \"iterations\": " << ops << ", \"seconds\": " << seconds
+			<< ", \"ns_per_op\": " << seconds * 1e9 / ops << ", \"ops_per_s\": " << ops / seconds << "}" << std::endl;
+}
+
+static std::string shape(const Tensor3D& tensor)
+{
+	std::ostringstream stream;
+	stream << tensor.height() << "x" << tensor.width() << "x" << tensor.depth();
+
+	return stream.str();
+}
+
+static Tensor3D randomTensor(size_t height, size_t width, size_t depth, size_t batch, std::mt19937& generator)
+{
+	std::normal_distribution<Real> rand(0, 1);
+	Tensor3D tensor(height, width, depth, batch);
+
+	for (size_t i(0); i < tensor.size(); ++i)
+		tensor.data()[i] = rand(generator);
+
+	return tensor;
+}
+
+// Each layer of the network at its own input shape
+static void benchmarkLayers(Benchmark& benchmark, const Network& network, size_t batchSize, std::mt19937& generator)
+{
+	Tensor3D input(randomTensor(10, 10, 1, batchSize, generator));
+
+	for (size_t l(0); l < network.layers(); ++l) {
+		const Layer& layer(network.layer(l));
+		std::string params("layer " + std::to_string(l) + ", input " + shape(input) + ", " + std::to_string(layer.weights.batch()) + " kernels " + shape(layer.weights) + ", batch " + std::to_string(batchSize));
+
+		Tensor3D output(convolution(input, layer.weights, layer.biases, layer.stride, layer.padding));
+
+		benchmark.run("convolution", params, [&]() { sink = sink + convolution(input, layer.weights, layer.biases, layer.stride, layer.padding).data()[0]; });
+		benchmark.run("deconvolution", params, [&]() { sink = sink + deconvolution(output, layer.weights, layer.stride, layer.padding).data()[0]; });
+		benchmark.run("relu", params, [&]() { sink = sink + relu(input).data()[0]; });
+		benchmark.run("relu_convolution", params, [&]() { sink = sink + reluConvolution(input, layer.weights, layer.biases, layer.stride, layer.padding).data()[0]; });
+
+		std::vector<Real> weightsGradient(layer.weights.size()), biasesGradient(layer.biases.size());
+		Tensor3D inputDeltas;
+
+		benchmark.run("relu_convolution_backward", params, [&]() {
+			reluConvolutionBackward(input, output, layer.weights, layer.stride, layer.padding, weightsGradient.data(), biasesGradient.data(), &inputDeltas);
+			sink = sink + inputDeltas.data()[0];
+		});
+
+		input = output;
+	}
+}
+
+static void benchmarkNetwork(Benchmark& benchmark, const Network& network, size_t batchSize, std::mt19937& generator)
+{
+	std::string params("batch " + std::to_string(batchSize));
+
+	Tensor3D input(randomTensor(10, 10, 1, batchSize, generator));
+	std::vector<Tensor3D> tensorStack(network.forward(input));
+	Network::Vector gradient;
+	Network::Matrix targets(Network::Matrix::Random(tensorStack.back().depth(), batchSize));
+
+	benchmark.run("forward", params, [&]() { sink = sink + network.forward(input).back().data()[0]; });
+
+	Network::Workspace workspace(network.workspace(input.height(), input.width(), batchSize));
+	benchmark.run("predict", params, [&]() { sink = sink + network.predict(input, workspace).data()[0]; });
+	benchmark.run("backward", params, [&]() {
+		network.backward(tensorStack, targets, gradient);
+		sink = sink + gradient(0);
+	});
+
+	Network copy(network);
+	OptimizerSettings settings;
+
+	for (OptimizerType type : { OptimizerType::RMSProp, OptimizerType::Adam }) {
+		settings.type = type;
+		Optimizer optimizer(settings);
+
+		benchmark.run("apply_gradient", params + (type == OptimizerType::RMSProp ? ", rmsprop" : ", adam"), [&]() { copy.applyGradient(gradient, optimizer); });
+	}
+}
+
+// Snapshots of the weights, such as those published to the actors
+static void benchmarkParameters(Benchmark& benchmark, const Network& network)
+{
+	std::string params(std::to_string(network.parameters()) + " parameters");
+	Network copy(network);
+
+	benchmark.run("network_copy", params, [&]() { sink = sink + Network(network).data()[0]; });
+	benchmark.run("copy_parameters", params, [&]() {
+		copy.copyParameters(network);
+		sink = sink + copy.data()[0];
+	});
+}
+
+// Inference of the shipped architecture on its static network, to compare with predict on a batch of 1
+static void benchmarkPolicy(Benchmark& benchmark, const Network& network, std::mt19937& generator)
+{
+	std::unique_ptr<PolicyNetwork> policy(new PolicyNetwork(network));
+	PolicyNetwork::Workspace workspace;
+	Tensor3D input(randomTensor(10, 10, 1, 1, generator));
+
+	benchmark.run("static_predict", "batch 1", [&]() { sink = sink + policy->predict(input, workspace)[0]; });
+	benchmark.run("static_copy_parameters", std::to_string(network.parameters()) + " parameters", [&]() {
+		policy->copyParameters(network);
+		sink = sink + policy->data()[0];
+	});
+}
+
+static void benchmarkGame(Benchmark& benchmark, std::mt19937& generator)
+{
+	Game game(10);
+	std::uniform_int_distribution<int> randAction(0, 3);
+
+	benchmark.run("game_next_state", "10x10", [&]() {
+		sink = sink + game.nextState(Direction(randAction(generator)));
+
+		if (game.isFinished())
+			game.initialize();
+	});
+
+	benchmark.run("game_state", "10x10", [&]() { sink = sink + game.state().data()[0]; });
+
+	Tensor3D states(10, 10, 1, 16);
+	size_t slot(0);
+
+	benchmark.run("game_state_into", "10x10, batch slot", [&]() {
+		game.state(states.data() + slot++ % states.batch() * states.sampleSize());
+		sink = sink + states.data()[0];
+	});
+}
+
+// Steps and states of K games at once, per game so that they compare with game_next_state and game_state
+static void benchmarkVecGame(Benchmark& benchmark, std::mt19937& generator)
+{
+	std::uniform_int_distribution<int> randAction(0, 3);
+
+	for (size_t nbGames : { 1, 64, 4096 }) {
+		std::string params("10x10, " + std::to_string(nbGames) + " games");
+		VecGame games(nbGames, 10);
+		Tensor3D states;
+
+		// Actions drawn beforehand, so that the generator is not timed with the games
+		std::vector<Direction> actions(nbGames * 64);
+		std::vector<double> rewards(nbGames);
+		std::unique_ptr<bool[]> isTerminal(new bool[nbGames]);
+		size_t turn(0);
+
+		for (Direction& action : actions)
+			action = Direction(randAction(generator));
+
+		benchmark.run("vecgame_step", params, [&]() {
+			games.step(actions.data() + turn++ % 64 * nbGames, rewards.data(), isTerminal.get());
+			sink = sink + rewards[0];
+		}, nbGames);
+
+		benchmark.run("vecgame_state", params, [&]() {
+			games.state(states);
+			sink = sink + states.data()[0];
+		}, nbGames);
+	}
+}
+
+// Uniforms of a batch of 16 samples : from a stream, from std::mt19937, and from a std::mt19937 seeded for every batch as sampling used to do
+static void benchmarkRandom(Benchmark& benchmark)
+{
+	std::vector<double> uniforms(16);
+	std::uniform_real_distribution<double> distribution(0.0, 1.0);
+	std::mt19937 generator(0);
+	Random random;
+
+	benchmark.run("random_uniforms", "batch 16, stream", [&]() {
+		random.uniforms(uniforms.data(), uniforms.size());
+		sink = sink + uniforms[0];
+	});
+	benchmark.run("random_uniforms", "batch 16, mt19937", [&]() {
+		for (double& u : uniforms)
+			u = distribution(generator);
+
+		sink = sink + uniforms[0];
+	});
+	benchmark.run("random_uniforms", "batch 16, mt19937 seeded by random_device", [&]() {
+		std::mt19937 seeded(std::random_device{}());
+
+		for (double& u : uniforms)
+			u = distribution(seeded);
+
+		sink = sink + uniforms[0];
+	});
+}
+
+// The memory is filled up to its capacity with real transitions before being measured
+static void benchmarkReplayOperations(Benchmark& benchmark, const std::string& prefix, const std::string& params, ReplayMemory& replayMemory,
+									  const std::vector<Transition>& transitions, size_t batchSize, std::mt19937& generator)
+{
+	std::uniform_real_distribution<double> randPriority(0.0, 1.0);
+	size_t next(0);
+
+	for (size_t i(0); i < replayMemory.capacity(); ++i)
+		replayMemory.push(transitions[i % transitions.size()], randPriority(generator));
+
+	TransitionBatch batch;
+	std::vector<double> priorities(batchSize);
+
+	benchmark.run(prefix + "_push", params, [&]() { replayMemory.push(transitions[next++ % transitions.size()], randPriority(generator)); });
+	benchmark.run(prefix + "_sample", params, [&]() {
+		replayMemory.sample(batchSize, batch);
+		sink = sink + batch.rewards[0];
+	});
+
+	// The priorities go to the last batch sampled, whose transitions are still in the memory
+	benchmark.run(prefix + "_set_val", params, [&]() { replayMemory.setVal(batch.indices[next++ % batchSize], randPriority(generator)); });
+	benchmark.run(prefix + "_set_vals", params, [&]() {
+		for (double& p : priorities)
+			p = randPriority(generator);
+
+		replayMemory.setVals(batch, priorities);
+	});
+}
+
+// The largest memory is measured again in a file, then reopened : ops of the reopening are the slots read to rebuild the sum tree
+static void benchmarkReplayMemory(Benchmark& benchmark, size_t maxLog2, size_t batchSize, std::mt19937& generator)
+{
+	Game game(10);
+	std::uniform_int_distribution<int> randAction(0, 3);
+	std::vector<Transition> transitions;
+
+	for (size_t i(0); i < 4096; ++i) {
+		transitions.push_back(Transition(game, Direction(randAction(generator))));
+
+		if (transitions.back().isTerminal)
+			game.initialize();
+	}
+
+	std::string params;
+
+	for (size_t log2(18); log2 <= maxLog2; log2 += 2) {
+		params = "2^" + std::to_string(log2) + " entries, batch " + std::to_string(batchSize);
+
+		ReplayMemory replayMemory(size_t(1) << log2);
+		benchmarkReplayOperations(benchmark, "replay", params, replayMemory, transitions, batchSize, generator);
+	}
+
+	size_t size(size_t(1) << maxLog2);
+	const std::string path("replay_benchmark.bin");
+	std::remove(path.c_str());
+
+	{
+		ReplayMemory replayMemory(path, size, 10, 10);
+		benchmarkReplayOperations(benchmark, "replay_file", params, replayMemory, transitions, batchSize, generator);
+	}
+
+	std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+
+	{
+		ReplayMemory replayMemory(path, size, 10, 10);
+		sink = sink + replayMemory.totalPriority();
+	}
+
+	benchmark.record("replay_file_reopen", params, size, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	std::remove(path.c_str());
+}
+
+// Whole training runs, ops are the steps played once the replay memories are filled
+static void benchmarkTraining(Benchmark& benchmark)
+{
+	TrainingSettings settings;
+	settings.replayMemorySize = 4096;
+	settings.verbose = false;
+	settings.checkpoints = false;
+
+	std::vector<size_t> actors = { 0, std::max<size_t>(1, std::thread::hardware_concurrency() - 1) };
+
+	for (size_t nbActors : actors) {
+		settings.nbActors = nbActors;
+		settings.nbEpisodes = nbActors ? 2000 : 100;
+
+		Agent agent;
+
+		std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+		size_t steps(agent.train(settings));
+		double seconds(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+		benchmark.record("train_steps", std::to_string(nbActors) + " actors, " + std::to_string(settings.nbEpisodes) + " episodes", steps, seconds);
+	}
+
+	// Same actors, each one stepping 64 games through VecGame
+	settings.gamesPerActor = 64;
+	settings.nbEpisodes = 2000;
+
+	Agent agent;
+
+	std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+	size_t steps(agent.train(settings));
+	double seconds(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+	benchmark.record("train_steps", std::to_string(settings.nbActors) + " actors x 64 games, " + std::to_string(settings.nbEpisodes) + " episodes", steps, seconds);
+}
+
+// For each grid size : the cost of a game step, of acting and of a learner batch, end-to-end training steps per second, and the size of the agents
+// and of a transition in the replay memory, with the number of transitions fitting in 1 GiB
+void runScalingBenchmarks(std::ostream& output, const std::vector<size_t>& gridSizes)
+{
+	Benchmark benchmark(output);
+	std::mt19937 generator(0);
+
+	Random::setSeed(0);
+
+	for (size_t gridSize : gridSizes) {
+		std::string grid(std::to_string(gridSize) + "x" + std::to_string(gridSize));
+		Agent agent(gridSize);
+		const Network& network(agent.network());
+
+		Game game(static_cast<int>(gridSize));
+		std::uniform_int_distribution<int> randAction(0, 3);
+
+		benchmark.run("game_next_state", grid, [&]() {
+			sink = sink + game.nextState(Direction(randAction(generator)));
+
+			if (game.isFinished())
+				game.initialize();
+		});
+
+		ReplayMemory replayMemory(4096);
+
+		for (size_t i(0); i < replayMemory.capacity(); ++i) {
+			Transition t(game, Direction(randAction(generator)));
+			replayMemory.push(t, 1.0);
+
+			if (t.isTerminal)
+				game.initialize();
+		}
+
+		Tensor3D state(randomTensor(gridSize, gridSize, 1, 1, generator));
+		Network::Workspace workspace(network.workspace(gridSize, gridSize));
+
+		benchmark.run("predict", grid + ", batch 1", [&]() { sink = sink + network.predict(state, workspace).data()[0]; });
+
+		TransitionBatch batch;
+		replayMemory.sample(16, batch);
+
+		std::vector<Tensor3D> tensorStack;
+		Network::Vector gradient;
+		Network::Matrix targets(Network::Matrix::Random(4, 16));
+
+		benchmark.run("forward_backward", grid + ", batch 16", [&]() {
+			tensorStack = network.forward(batch.states);
+			network.backward(tensorStack, targets, gradient);
+			sink = sink + gradient(0);
+		});
+
+		// Episodes are at least gridSize steps long, so that every grid plays about 200 steps or more
+		TrainingSettings settings;
+		settings.replayMemorySize = 4096;
+		settings.nbEpisodes = std::max<size_t>(1, 200 / gridSize);
+		settings.verbose = false;
+		settings.checkpoints = false;
+
+		std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+		size_t steps(agent.train(settings));
+		double seconds(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+		benchmark.record("train_steps", grid + ", " + std::to_string(settings.nbEpisodes) + " episodes", steps, seconds);
+
+		size_t bytesPerTransition(replayMemory.bytesPerTransition());
+
+		output << "{\"benchmark\": \"grid_memory\", \"params\": \"" << grid << "\", \"parameters\": " << network.parameters()
+			   << ", \"bytes_per_transition\": " << bytesPerTransition << ", \"transitions_per_gib\": " << ReplayMemory::capacityFor(size_t(1) << 30, gridSize, gridSize) << "}" << std::endl;
+	}
+}
+
+void runBenchmarks(std::ostream& output, size_t maxReplayLog2)
+{
+	Benchmark benchmark(output);
+	std::mt19937 generator(0);
+
+	Random::setSeed(0);
+	Agent agent;
+
+	output << "{\"benchmark\": \"build\", \"scalar\": \"" << (sizeof(Real) == sizeof(float) ? "float" : "double") << "\", \"threads\": " << std::thread::hardware_concurrency() << "}" << std::endl;
+
+	for (size_t batchSize : { 1, 16 }) {
+		benchmarkLayers(benchmark, agent.network(), batchSize, generator);
+		benchmarkNetwork(benchmark, agent.network(), batchSize, generator);
+	}
+
+	benchmarkParameters(benchmark, agent.network());
+	benchmarkPolicy(benchmark, agent.network(), generator);
+
+	benchmarkGame(benchmark, generator);
+	benchmarkVecGame(benchmark, generator);
+	benchmarkRandom(benchmark);
+	benchmarkReplayMemory(benchmark, maxReplayLog2, 16, generator);
+	benchmarkTraining(benchmark);
+}
@@ -0,0 +1,57 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+
+// Times a function and writes one JSON object per line :
+//   {"benchmark": name, "params": params, "iterations": n, "seconds": total time, "ns_per_op": time per call, "ops_per_s": calls per second}
+// The function is run once to warm up, then with twice as many iterations until it takes at least minTime seconds
+// A function doing several ops per call, such as a step of a batch of games, gives their number so that ns_per_op is per op
+class Benchmark
+{
+public:
+	Benchmark(std::ostream&, double = 0.25);
+
+	template <typename Function>
+	void run(const std::string&, const std::string&, Function, size_t = 1);
+
+	// For runs timed by the caller, ops being whatever was counted (steps, updates...)
+	void record(const std::string&, const std::string&, size_t, double);
+
+private:
+	std::ostream& mOutput;
+	double mMinTime;
+};
+
+template <typename Function>
+void Benchmark::run(const std::string& name, const std::string& params, Function function, size_t opsPerCall)
+{
+	function();
+
+	for (size_t iterations(1); ; iterations *= 2) {
+		std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+
+		for (size_t i(0); i < iterations; ++i)
+			function();
+
+		double seconds(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+		if (seconds >= mMinTime) {
+			record(name, params, iterations * opsPerCall, seconds);
+			return;
+		}
+	}
+}
+
+// Every hot path of the training : layers of the Agent network, whole network, game, batched games, random numbers, replay memory and end-to-end training
+// Replay memories go from 2^18 to 2^maxReplayLog2 entries
+// The benchmarks set the seed of the run to 0, so that they draw the same numbers from one run to the next
+void runBenchmarks(std::ostream&, size_t = 24);
+
+// Costs and memory of the agents for each grid size, to plan the capacity of larger grids
+void runScalingBenchmarks(std::ostream&, const std::vector<size_t>& = { 10, 20, 32, 64 });
+
+#endif // BENCHMARK_H
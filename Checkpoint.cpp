@@ -0,0 +1,191 @@
+#include "Checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace
+{
+	const size_t headerFields = 4, layerFields = 6, dataAlignment = 64;
+
+	size_t dataOffset(size_t nbLayers)
+	{
+		size_t headerSize((headerFields + layerFields * nbLayers) * sizeof(uint32_t));
+		return (headerSize + dataAlignment - 1) / dataAlignment * dataAlignment;
+	}
+
+	// Checkpoints saved with the other scalar type are converted
+	void readScalars(const char* data, size_t scalarSize, size_t count, Real* output)
+	{
+		if (scalarSize == sizeof(Real)) {
+			std::memcpy(output, data, count * sizeof(Real));
+		} else if (scalarSize == sizeof(float)) {
+			for (size_t i(0); i < count; ++i, data += sizeof(float)) {
+				float value;
+				std::memcpy(&value, data, sizeof(float));
+				output[i] = Real(value);
+			}
+		} else {
+			for (size_t i(0); i < count; ++i, data += sizeof(double)) {
+				double value;
+				std::memcpy(&value, data, sizeof(double));
+				output[i] = Real(value);
+			}
+		}
+	}
+}
+
+void Checkpoint::save(const Network& network, const std::string& path)
+{
+	std::vector<uint32_t> header = { magic, version, uint32_t(sizeof(Real)), uint32_t(network.layers()) };
+
+	for (size_t l(0); l < network.layers(); ++l) {
+		const Layer& layer(network.layer(l));
+
+		header.insert(header.end(), { uint32_t(layer.weights.batch()), uint32_t(layer.weights.height()), uint32_t(layer.weights.width()),
+									  uint32_t(layer.weights.depth()), uint32_t(layer.stride), uint32_t(layer.padding) });
+	}
+
+	// Write next to the checkpoint then replace it, so that a reader never sees a partial file
+	std::string tmpPath(path + ".tmp");
+	std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+
+	if (!file)
+		throw std::runtime_error("Checkpoint: cannot open " + tmpPath);
+
+	std::vector<char> padding(dataOffset(network.layers()) - header.size() * sizeof(uint32_t), 0);
+
+	file.write(reinterpret_cast<const char*>(header.data()), header.size() * sizeof(uint32_t));
+	file.write(padding.data(), padding.size());
+
+	file.write(reinterpret_cast<const char*>(network.data()), network.size() * sizeof(Real));
+	file.close();
+
+	if (!file)
+		throw std::runtime_error("Checkpoint: cannot write " + tmpPath);
+
+#ifdef _WIN32
+	std::remove(path.c_str()); // rename does not overwrite on Windows
+#endif
+
+	if (std::rename(tmpPath.c_str(), path.c_str()))
+		throw std::runtime_error("Checkpoint: cannot replace " + path);
+}
+
+Network Checkpoint::load(const std::string& path)
+{
+	MappedFile file(path);
+	const uint32_t* header(reinterpret_cast<const uint32_t*>(file.data()));
+
+	if (file.size() < headerFields * sizeof(uint32_t) || header[0] != magic)
+		throw std::runtime_error("Checkpoint: " + path + " is not a checkpoint");
+
+	if (header[1] != version)
+		throw std::runtime_error("Checkpoint: unsupported version " + std::to_string(header[1]) + " in " + path);
+
+	if (header[2] != sizeof(float) && header[2] != sizeof(double))
+		throw std::runtime_error("Checkpoint: unknown scalar type in " + path);
+
+	size_t scalarSize(header[2]), nbLayers(header[3]), offset(dataOffset(nbLayers));
+
+	if (file.size() < offset)
+		throw std::runtime_error("Checkpoint: " + path + " is truncated");
+
+	Network network;
+	const uint32_t* shape(header + headerFields);
+
+	// The parameters come from the file, drawing them would only take time and move the random stream of the thread
+	for (size_t l(0); l < nbLayers; ++l, shape += layerFields)
+		network.addLayer(shape[0], shape[1], shape[2], shape[3], shape[4], shape[5], false);
+
+	// The layout of the parameters is counted in scalars, so it is the same for float and double
+	if (file.size() < offset + network.size() * scalarSize)
+		throw std::runtime_error("Checkpoint: " + path + " is truncated");
+
+	readScalars(file.data() + offset, scalarSize, network.size(), network.data());
+
+	return network;
+}
+
+bool Checkpoint::isBinary(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	uint32_t value(0);
+
+	file.read(reinterpret_cast<char*>(&value), sizeof(value));
+
+	return file && value == magic;
+}
+
+CheckpointWriter::CheckpointWriter() :
+	mIsWriting(false),
+	mStop(false),
+	mThread(&CheckpointWriter::_run, this)
+{
+}
+
+// Pending snapshots are written before the thread stops
+CheckpointWriter::~CheckpointWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+
+	mCondition.notify_all();
+	mThread.join();
+}
+
+// Only the copy of the weights is done by the calling thread
+void CheckpointWriter::save(const Network& network, const std::string& path)
+{
+	std::shared_ptr<const Network> snapshot(std::make_shared<Network>(network));
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mPending[path] = snapshot;
+	}
+
+	mCondition.notify_all();
+}
+
+void CheckpointWriter::wait()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mCondition.wait(lock, [this]() { return mPending.empty() && !mIsWriting; });
+}
+
+void CheckpointWriter::_run()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+
+	while (true) {
+		mCondition.wait(lock, [this]() { return mStop || !mPending.empty(); });
+
+		if (mPending.empty())
+			return;
+
+		std::string path(mPending.begin()->first);
+		std::shared_ptr<const Network> snapshot(mPending.begin()->second);
+
+		mPending.erase(mPending.begin());
+		mIsWriting = true;
+		lock.unlock();
+
+		try {
+			Checkpoint::save(*snapshot, path);
+		} catch (const std::exception& e) {
+			std::cerr << e.what() << "\n"; // A failed checkpoint must not end the training
+		}
+
+		lock.lock();
+		mIsWriting = false;
+		mCondition.notify_all();
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <map>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <condition_variable>
+#include "Network.h"
+#include "MappedFile.h"
+
+// Binary checkpoint, in the byte order of the machine :
+//   header : magic, version, scalar size, number of layers
+//   then for each layer : kernels, kernel height, kernel width, kernel depth, stride, padding (all uint32)
+//   then, from the first multiple of 64 bytes, the parameters of the network as laid out in memory (Network::data())
+namespace Checkpoint
+{
+	const uint32_t magic = 0x574B4E53; // "SNKW"
+	const uint32_t version = 2;
+
+	void save(const Network&, const std::string&);
+	Network load(const std::string&);
+
+	// Checkpoints start with the magic number, older ones are text files
+	bool isBinary(const std::string&);
+}
+
+// Saves on a background thread from snapshots of the weights
+// Only the most recent snapshot of each path is kept, so a slow disk never queues up copies of the network
+class CheckpointWriter
+{
+public:
+	CheckpointWriter();
+	~CheckpointWriter();
+
+	void save(const Network&, const std::string&);
+	void wait();
+
+private:
+	void _run();
+
+	std::map<std::string, std::shared_ptr<const Network>> mPending;
+	bool mIsWriting;
+	bool mStop;
+
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	std::thread mThread;
+};
+
+#endif // CHECKPOINT_H
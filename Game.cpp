@@ -1,22 +1,32 @@
 #include "Game.h"
 
-Game::Game(int gridSize) :
-	mGenerator(std::random_device{}()),
-	mRandCoord(0, gridSize - 1),
-	mGrid(2, Eigen::Matrix<bool, -1, -1>(gridSize, gridSize))
+Game::Game(int gridSize, const Random& random) :
+	mRandom(random),
+	mGrid(2, Eigen::Matrix<bool, -1, -1>(gridSize, gridSize)),
+	mBody(gridSize * gridSize),
+	mFreeCells(gridSize * gridSize),
+	mFreeIndex(gridSize * gridSize)
 {
 	initialize();
 }
 
 void Game::initialize()
 {
-	for (size_t i(0); i < mGrid[0].rows(); ++i)
-		for (size_t j(0); j < mGrid[0].cols(); ++j)
-			mGrid[0](i, j) = mGrid[1](i, j) = false; // Empty grid
+	mGrid[0].setConstant(false); // Empty grid
+	mGrid[1].setConstant(false);
 
-	mBody = { { mRandCoord(mGenerator), mRandCoord(mGenerator) } };
-	mGrid[0](mBody[0].x, mBody[0].y) = true;
-	mDirectionList = { Right };
+	mFreeCells.resize(mFreeIndex.size());
+
+	for (size_t c(0); c < mFreeCells.size(); ++c)
+		mFreeCells[c] = mFreeIndex[c] = int(c);
+
+	mTail = 0;
+	mLength = 1;
+	mBody[0] = { int(mRandom.uniform(size_t(mGrid[0].rows()))), int(mRandom.uniform(size_t(mGrid[0].cols()))) };
+	_occupy(mBody[0]);
+
+	mDirection = Right;
+	mHasApple = false;
 	mNbApples = 0;
 	mScore = 0.;
 
@@ -47,102 +57,171 @@ bool Game::isFinished() const
 
 Tensor3D Game::state() const
 {
-	Tensor3D state(mGrid[0].rows(), mGrid[0].cols(), 1);
+	Tensor3D state;
+	Game::state(state);
 
-	for (size_t i(0); i < mGrid[0].rows(); ++i) {
-		for (size_t j(0); j < mGrid[0].cols(); ++j) {
-			int x = (i - mBody[0].x + int(mGrid[0].rows() * 1.5)) % mGrid[0].rows(),
-				y = (j - mBody[0].y + int(mGrid[0].cols() * 1.5)) % mGrid[0].cols();
+	return state;
+}
 
-			
-			state(x, y, 0) = std::min(mGrid[0](i, j) + mGrid[1](i, j) * 0.299, 1.0);
-		}
-	}
+// The tensor is only reallocated if it does not have the shape of a single state
+void Game::state(Tensor3D& state) const
+{
+	if (state.height() != size_t(mGrid[0].rows()) || state.width() != size_t(mGrid[0].cols()) || state.depth() != 1 || state.batch() != 1)
+		state.resize(mGrid[0].rows(), mGrid[0].cols(), 1);
 
-	return state;
+	Game::state(state.data());
+}
+
+// Recentering is a rotation of the rows and of the columns : the column j goes to (j + shiftY) % cols, and within it
+// the rows [0, rows - shiftX) go to [shiftX, rows) while the others wrap around to the top
+void Game::state(Real* state) const
+{
+	static const Real values[4] = { Real(0.0), Real(0.299), Real(1.0), Real(1.0) }; // Indexed by 2 * body + apple
+
+	int rows(mGrid[0].rows()), cols(mGrid[0].cols());
+	Coords head(_head());
+	int shiftX((int(rows * 1.5) - head.x) % rows), shiftY((int(cols * 1.5) - head.y) % cols);
+
+	for (int j(0); j < cols; ++j) {
+		const bool* body(&mGrid[0](0, j));
+		const bool* apple(&mGrid[1](0, j));
+		Real* column(state + (j + shiftY) % cols * rows);
+
+		for (int i(0); i < rows - shiftX; ++i)
+			column[i + shiftX] = values[2 * body[i] + apple[i]];
+
+		for (int i(rows - shiftX); i < rows; ++i)
+			column[i + shiftX - rows] = values[2 * body[i] + apple[i]];
+	}
 }
 
-std::vector<Eigen::Matrix<bool, -1, -1>> Game::grid() const
+const std::vector<Eigen::Matrix<bool, -1, -1>>& Game::grid() const
 {
 	return mGrid;
 }
 
+const Eigen::Matrix<bool, -1, -1>& Game::body() const
+{
+	return mGrid[0];
+}
+
+const Eigen::Matrix<bool, -1, -1>& Game::apple() const
+{
+	return mGrid[1];
+}
+
 double Game::score() const
 {
 	return mScore;
 }
 
+// Uniform among the free cells, there is no apple anymore if the snake fills the grid
 void Game::_generateApple()
 {
-	mGrid[1](mApple.x, mApple.y) = false;
+	if (mHasApple)
+		mGrid[1](mApple.x, mApple.y) = false;
+
+	mHasApple = !mFreeCells.empty();
+
+	if (!mHasApple)
+		return;
 
-	do {
-		mApple = { mRandCoord(mGenerator), mRandCoord(mGenerator) };
-	} while (mGrid[0](mApple.x, mApple.y));
+	int cell(mFreeCells[mRandom.uniform(mFreeCells.size())]);
 
+	mApple = { int(cell / mGrid[0].cols()), int(cell % mGrid[0].cols()) };
 	mGrid[1](mApple.x, mApple.y) = true;
 }
 
+// Only the head and the tail move, whatever the length of the snake
 bool Game::_moveSnake(Direction nextDir)
 {
 	if (isFinished())
 		return false;
 
-	std::list<Direction>::iterator it(mDirectionList.begin());
-	Coords last(mBody.back());
+	Coords head(_head());
 
-	for (size_t i(0); i < mBody.size(); ++i, ++it) {
-		mGrid[0](mBody[i].x, mBody[i].y) = false;
+	switch (mDirection) {
+	case Up:
+		head.x += mGrid[0].rows() - 1;
+		break;
 
-		switch (*it) {
-		case Up:
-			mBody[i].x += mGrid[0].rows() - 1;
-			break;
+	case Down:
+		head.x += 1;
+		break;
 
-		case Down:
-			mBody[i].x += 1;
-			break;
+	case Left:
+		head.y += mGrid[0].cols() - 1;
+		break;
 
-		case Left:
-			mBody[i].y += mGrid[0].cols() - 1;
-			break;
+	case Right:
+		head.y += 1;
+		break;
 
-		case Right:
-			mBody[i].y += 1;
-			break;
+	default:
+		break;
+	}
 
-		}
+	head.x %= mGrid[0].rows();
+	head.y %= mGrid[0].cols();
 
-		mBody[i].x %= mGrid[0].rows();
-		mBody[i].y %= mGrid[0].cols();
-	}
+	mDirection = nextDir;
 
-	// If the snakes eats an apple...
-	if (mNbApples) {
-		mBody.push_back(last);
-		--mNbApples;
+	// The snake grows the step after eating an apple, otherwise its tail leaves its cell
+	bool grows(mNbApples > 0);
 
-		_generateApple();
+	if (grows) {
+		--mNbApples;
 	} else {
-		mDirectionList.pop_back();
+		_vacate(mBody[mTail]);
+		mTail = (mTail + 1) % mBody.size();
+		--mLength;
 	}
 
-	mDirectionList.push_front(nextDir);
-
-
-	for (Coords pos : mBody) {
-		// If the snake eats itself, he dies
-		if (mGrid[0](pos.x, pos.y))
-			return false;
+	// If the snake eats itself, he dies
+	if (mGrid[0](head.x, head.y))
+		return false;
 
-		if (mGrid[1](pos.x, pos.y)) {
-			++mNbApples;
-			mScore += 1.0;
-		}
+	mBody[(mTail + mLength) % mBody.size()] = head;
+	++mLength;
+	_occupy(head);
 
-		mGrid[0](pos.x, pos.y) = true;
+	// The apple stays under the snake until it grows
+	if (mHasApple && head.x == mApple.x && head.y == mApple.y) {
+		++mNbApples;
+		mScore += 1.0;
 	}
 
+	if (grows)
+		_generateApple();
+
 	// The snake lives !
 	return true;
 }
+
+Coords Game::_head() const
+{
+	return mBody[(mTail + mLength - 1) % mBody.size()];
+}
+
+// Swap the cell with the last free cell, then drop it
+void Game::_occupy(Coords pos)
+{
+	int cell(pos.x * mGrid[0].cols() + pos.y),
+		last(mFreeCells.back());
+
+	mFreeCells[mFreeIndex[cell]] = last;
+	mFreeIndex[last] = mFreeIndex[cell];
+	mFreeCells.pop_back();
+
+	mGrid[0](pos.x, pos.y) = true;
+}
+
+void Game::_vacate(Coords pos)
+{
+	int cell(pos.x * mGrid[0].cols() + pos.y);
+
+	mFreeIndex[cell] = mFreeCells.size();
+	mFreeCells.push_back(cell);
+
+	mGrid[0](pos.x, pos.y) = false;
+}
@@ -1,10 +1,9 @@
 #ifndef GAME_H
 #define GAME_H
 
-#include <list>
-#include <random>
 #include <iostream>
 #include "Tensor3D.h"
+#include "Random.h"
 
 enum Direction {
 	Up,
@@ -22,32 +21,48 @@ struct Coords
 class Game
 {
 public:
-	Game(int);
+	Game(int, const Random& = Random());
 	void initialize();
 	double nextState(Direction);
 
 	bool isFinished() const;
 
+	// Head-centered view of the grid : 1 for the body, 0.299 for the apple and 0 elsewhere
 	Tensor3D state() const;
-	std::vector<Eigen::Matrix<bool, -1, -1>> grid() const;
+	void state(Tensor3D&) const;
+	void state(Real*) const; // rows * cols values, column-major as a sample of a Tensor3D
+
+	const std::vector<Eigen::Matrix<bool, -1, -1>>& grid() const;
+	const Eigen::Matrix<bool, -1, -1>& body() const;
+	const Eigen::Matrix<bool, -1, -1>& apple() const;
 	double score() const;
 
 private:
 	void _generateApple();
 	bool _moveSnake(Direction);
 
-	std::vector<Eigen::Matrix<bool, -1, -1>> mGrid;
+	Coords _head() const;
+	void _occupy(Coords);
+	void _vacate(Coords);
+
+	std::vector<Eigen::Matrix<bool, -1, -1>> mGrid; // Body and apple
 
+	// Ring buffer of the body, from the tail to the head : a move only writes the new head and drops the tail
 	std::vector<Coords> mBody;
-	std::list<Direction> mDirectionList;
-	
+	size_t mTail, mLength;
+	Direction mDirection; // The snake moves one step behind the actions, this is the direction of the next move
+
+	// Cells outside the body, in any order, and the position of every cell in mFreeCells
+	std::vector<int> mFreeCells;
+	std::vector<int> mFreeIndex;
+
 	Coords mApple;
+	bool mHasApple;
 	size_t mNbApples;
 
 	double mScore;
 
-	std::mt19937 mGenerator;
-	std::uniform_int_distribution<int> mRandCoord;
+	Random mRandom;
 
 	bool mIsFinished;
 };
@@ -0,0 +1,184 @@
+#include "MappedFile.h"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path) :
+	mData(nullptr),
+	mSize(0),
+	mFile(INVALID_HANDLE_VALUE),
+	mMapping(nullptr)
+{
+	mFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (mFile == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("MappedFile: cannot open " + path);
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(mFile, &size);
+	mSize = size_t(size.QuadPart);
+
+	if (!mSize)
+		return;
+
+	mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	mData = mMapping ? static_cast<char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+
+	if (!mData) {
+		if (mMapping)
+			CloseHandle(mMapping);
+
+		CloseHandle(mFile);
+		throw std::runtime_error("MappedFile: cannot map " + path);
+	}
+}
+
+MappedFile::MappedFile(const std::string& path, size_t minSize) :
+	mData(nullptr),
+	mSize(0),
+	mFile(INVALID_HANDLE_VALUE),
+	mMapping(nullptr)
+{
+	mFile = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (mFile == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("MappedFile: cannot open " + path);
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(mFile, &size);
+	mSize = size_t(size.QuadPart);
+
+	if (mSize < minSize) {
+		size.QuadPart = LONGLONG(minSize);
+
+		if (!SetFilePointerEx(mFile, size, nullptr, FILE_BEGIN) || !SetEndOfFile(mFile)) {
+			CloseHandle(mFile);
+			throw std::runtime_error("MappedFile: cannot grow " + path);
+		}
+
+		mSize = minSize;
+	}
+
+	if (!mSize)
+		return;
+
+	mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+	mData = mMapping ? static_cast<char*>(MapViewOfFile(mMapping, FILE_MAP_WRITE, 0, 0, 0)) : nullptr;
+
+	if (!mData) {
+		if (mMapping)
+			CloseHandle(mMapping);
+
+		CloseHandle(mFile);
+		throw std::runtime_error("MappedFile: cannot map " + path);
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	if (mData)
+		UnmapViewOfFile(mData);
+
+	if (mMapping)
+		CloseHandle(mMapping);
+
+	CloseHandle(mFile);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) :
+	mData(nullptr),
+	mSize(0),
+	mFile(open(path.c_str(), O_RDONLY))
+{
+	if (mFile < 0)
+		throw std::runtime_error("MappedFile: cannot open " + path);
+
+	struct stat status;
+	fstat(mFile, &status);
+	mSize = size_t(status.st_size);
+
+	if (!mSize)
+		return;
+
+	void* data(mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, mFile, 0));
+
+	if (data == MAP_FAILED) {
+		close(mFile);
+		throw std::runtime_error("MappedFile: cannot map " + path);
+	}
+
+	mData = static_cast<char*>(data);
+}
+
+// Growing the file leaves a hole, the disk is only used as the pages are written
+MappedFile::MappedFile(const std::string& path, size_t minSize) :
+	mData(nullptr),
+	mSize(0),
+	mFile(open(path.c_str(), O_RDWR | O_CREAT, 0644))
+{
+	if (mFile < 0)
+		throw std::runtime_error("MappedFile: cannot open " + path);
+
+	struct stat status;
+	fstat(mFile, &status);
+	mSize = size_t(status.st_size);
+
+	if (mSize < minSize) {
+		if (ftruncate(mFile, off_t(minSize))) {
+			close(mFile);
+			throw std::runtime_error("MappedFile: cannot grow " + path);
+		}
+
+		mSize = minSize;
+	}
+
+	if (!mSize)
+		return;
+
+	void* data(mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFile, 0));
+
+	if (data == MAP_FAILED) {
+		close(mFile);
+		throw std::runtime_error("MappedFile: cannot map " + path);
+	}
+
+	mData = static_cast<char*>(data);
+}
+
+MappedFile::~MappedFile()
+{
+	if (mData)
+		munmap(mData, mSize);
+
+	close(mFile);
+}
+
+#endif
+
+const char* MappedFile::data() const
+{
+	return mData;
+}
+
+char* MappedFile::data()
+{
+	return mData;
+}
+
+size_t MappedFile::size() const
+{
+	return mSize;
+}
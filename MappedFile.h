@@ -0,0 +1,35 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <cstddef>
+
+// Mapping of a whole file in memory
+// The read-only mapping is private to the process, the writable one is shared : what is written goes to the file
+class MappedFile
+{
+public:
+	MappedFile(const std::string&); // Read-only, the file must exist
+	MappedFile(const std::string&, size_t); // Writable, the file is created if needed and grown to at least the given size
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* data() const;
+	char* data(); // Only written through for writable mappings
+	size_t size() const;
+
+private:
+	char* mData;
+	size_t mSize;
+
+#ifdef _WIN32
+	void* mFile;
+	void* mMapping;
+#else
+	int mFile;
+#endif
+};
+
+#endif // MAPPEDFILE_H
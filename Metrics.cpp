@@ -0,0 +1,152 @@
+#include "Metrics.h"
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+namespace
+{
+	// Only written by its thread, the atomics let the flushing thread read them at any time
+	struct Counters
+	{
+		std::array<std::atomic<uint64_t>, Metrics::NbPhases> nanoseconds;
+		std::array<std::atomic<uint64_t>, Metrics::NbPhases> calls;
+
+		Counters()
+		{
+			for (size_t p(0); p < Metrics::NbPhases; ++p)
+				nanoseconds[p] = calls[p] = 0;
+		}
+	};
+
+	std::atomic<bool> enabled(false);
+
+	// The counters of a thread are kept once it ends, so that the totals never go back
+	std::mutex registryMutex;
+	std::vector<std::shared_ptr<Counters>> registry;
+
+	Counters& threadCounters()
+	{
+		thread_local std::shared_ptr<Counters> counters;
+
+		if (!counters) {
+			counters = std::make_shared<Counters>();
+
+			std::lock_guard<std::mutex> lock(registryMutex);
+			registry.push_back(counters);
+		}
+
+		return *counters;
+	}
+
+	void increase(std::atomic<uint64_t>& counter, uint64_t value)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+}
+
+const char* Metrics::name(Phase phase)
+{
+	static const char* names[NbPhases] = { "env_step", "act", "replay_push", "replay_sample", "replay_update", "forward", "backward",
+										   "gradient_reduction", "apply_gradient", "checkpoint" };
+
+	return names[phase];
+}
+
+void Metrics::enable(bool isEnabled)
+{
+	enabled = isEnabled;
+}
+
+bool Metrics::isEnabled()
+{
+	return enabled.load(std::memory_order_relaxed);
+}
+
+void Metrics::add(Phase phase, double seconds, size_t calls)
+{
+	Counters& counters(threadCounters());
+
+	increase(counters.nanoseconds[phase], uint64_t(seconds * 1e9));
+	increase(counters.calls[phase], calls);
+}
+
+Metrics::Timer::Timer(Phase phase) :
+	mPhase(phase),
+	mIsRunning(isEnabled())
+{
+	if (mIsRunning)
+		mStart = std::chrono::steady_clock::now();
+}
+
+Metrics::Timer::~Timer()
+{
+	stop();
+}
+
+void Metrics::Timer::stop()
+{
+	if (!mIsRunning)
+		return;
+
+	mIsRunning = false;
+	add(mPhase, std::chrono::duration<double>(std::chrono::steady_clock::now() - mStart).count());
+}
+
+Metrics::Totals Metrics::totals()
+{
+	Totals totals;
+	totals.seconds.fill(0.0);
+	totals.calls.fill(0);
+
+	std::lock_guard<std::mutex> lock(registryMutex);
+
+	for (const std::shared_ptr<Counters>& counters : registry) {
+		for (size_t p(0); p < NbPhases; ++p) {
+			totals.seconds[p] += counters->nanoseconds[p].load(std::memory_order_relaxed) * 1e-9;
+			totals.calls[p] += counters->calls[p].load(std::memory_order_relaxed);
+		}
+	}
+
+	return totals;
+}
+
+MetricsWriter::MetricsWriter(std::ostream& output, double interval) :
+	mOutput(output),
+	mInterval(interval),
+	mLast(Metrics::totals()),
+	mLastFlush(std::chrono::steady_clock::now())
+{
+}
+
+bool MetricsWriter::isDue() const
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - mLastFlush).count() >= mInterval;
+}
+
+void MetricsWriter::flush(const std::vector<std::pair<std::string, double>>& gauges)
+{
+	std::chrono::steady_clock::time_point now(std::chrono::steady_clock::now());
+	double elapsed(std::chrono::duration<double>(now - mLastFlush).count());
+	Metrics::Totals totals(Metrics::totals());
+
+	mOutput << "{\"metrics\": " << elapsed << ", \"phases\": {";
+
+	for (size_t p(0); p < Metrics::NbPhases; ++p) {
+		size_t calls(totals.calls[p] - mLast.calls[p]);
+
+		mOutput << (p ? ", " : "") << "\"" << Metrics::name(Metrics::Phase(p)) << "\": {\"calls\": " << calls
+				<< ", \"ms\": " << (totals.seconds[p] - mLast.seconds[p]) * 1e3 << ", \"per_s\": " << calls / elapsed << "}";
+	}
+
+	mOutput << "}, \"gauges\": {";
+
+	for (size_t g(0); g < gauges.size(); ++g)
+		mOutput << (g ? ", " : "") << "\"" << gauges[g].first << "\": " << gauges[g].second;
+
+	mOutput << "}}" << std::endl;
+
+	mLast = totals;
+	mLastFlush = now;
+}
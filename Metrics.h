@@ -0,0 +1,75 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <utility>
+#include <iostream>
+
+// Time spent in each phase of the training and number of calls, accumulated by every thread on its own counters
+// A timer costs two clock reads while the metrics are enabled and a single test otherwise
+namespace Metrics
+{
+	enum Phase { EnvStep, Act, ReplayPush, ReplaySample, ReplayUpdate, Forward, Backward, GradientReduction, ApplyGradient, Checkpointing, NbPhases };
+
+	const char* name(Phase);
+
+	void enable(bool);
+	bool isEnabled();
+
+	// Seconds and calls added to the counters of the calling thread
+	void add(Phase, double, size_t = 1);
+
+	// Times its scope, or until stop() is called
+	class Timer
+	{
+	public:
+		Timer(Phase);
+		~Timer();
+
+		Timer(const Timer&) = delete;
+		Timer& operator=(const Timer&) = delete;
+
+		void stop();
+
+	private:
+		Phase mPhase;
+		bool mIsRunning;
+		std::chrono::steady_clock::time_point mStart;
+	};
+
+	// Sums over all the threads, those that ended included
+	struct Totals
+	{
+		std::array<double, NbPhases> seconds;
+		std::array<size_t, NbPhases> calls;
+	};
+
+	Totals totals();
+}
+
+// Writes what was accumulated since the previous flush as one JSON line :
+//   {"metrics": seconds since the previous flush, "phases": {name: {"calls": n, "ms": thread time, "per_s": calls per second}, ...}, "gauges": {name: value, ...}}
+// Phases running on several threads at once can add up to more than the wall time
+class MetricsWriter
+{
+public:
+	MetricsWriter(std::ostream&, double);
+
+	// The interval has elapsed since the previous flush
+	bool isDue() const;
+
+	// Gauges are instantaneous values given by the caller, such as the fill level of a replay memory
+	void flush(const std::vector<std::pair<std::string, double>>& = {});
+
+private:
+	std::ostream& mOutput;
+	double mInterval;
+
+	Metrics::Totals mLast;
+	std::chrono::steady_clock::time_point mLastFlush;
+};
+
+#endif // METRICS_H
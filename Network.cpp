@@ -1,140 +1,239 @@
 #include "Network.h"
 
-std::vector<Tensor3D> Network::forward(const Tensor3D& input) const
+#include <random>
+#include <stdexcept>
+#include "Random.h"
+
+// Two allocations whatever the number of layers : the parameters and the layers viewing them
+template <typename Scalar>
+BasicNetwork<Scalar>::BasicNetwork(const BasicNetwork& other) :
+	mParameters(other.mParameters)
 {
-	std::vector<Tensor3D> tensorStack({ input });
+	_bind(other.mLayers);
+}
+
+template <typename Scalar>
+BasicNetwork<Scalar>& BasicNetwork<Scalar>::operator=(const BasicNetwork& other)
+{
+	BasicNetwork copy(other);
+	swap(copy);
+
+	return *this;
+}
+
+// Every tensor of the stack holds the whole batch
+template <typename Scalar>
+std::vector<BasicTensor3D<Scalar>> BasicNetwork<Scalar>::forward(const Tensor& input) const
+{
+	std::vector<Tensor> tensorStack({ input });
 
 	for (const Layer& layer : mLayers)
-		tensorStack.push_back(convolution(relu(tensorStack.back()), layer.kernels, layer.stride, layer.padding));
+		tensorStack.push_back(reluConvolution(tensorStack.back(), layer.weights, layer.biases, layer.stride, layer.padding));
 
 	return tensorStack;
 }
 
-// Compute the gradient
-void Network::backward(const std::vector<Tensor3D>& tensorStack, const Eigen::VectorXd& target, std::vector<std::vector<Tensor3D>>& weightsGradient, std::vector<std::vector<double>>& biasesGradient)
+template <typename Scalar>
+typename BasicNetwork<Scalar>::Workspace BasicNetwork<Scalar>::workspace(size_t height, size_t width, size_t batchSize) const
+{
+	Workspace workspace;
+	size_t activationSize(0), columnsSize(0), productsSize(0);
+
+	for (const Layer& layer : mLayers) {
+		height = (height - layer.weights.height() + 2 * layer.padding) / layer.stride + 1;
+		width = (width - layer.weights.width() + 2 * layer.padding) / layer.stride + 1;
+
+		activationSize = std::max(activationSize, height * width * layer.weights.batch() * batchSize);
+		columnsSize = std::max(columnsSize, height * width * layer.weights.sampleSize() * batchSize);
+		productsSize = std::max(productsSize, height * width * layer.weights.batch() * batchSize);
+	}
+
+	workspace.activations[0].reserve(activationSize);
+	workspace.activations[1].reserve(activationSize);
+	workspace.columns.reserve(columnsSize);
+	workspace.products.reserve(productsSize);
+
+	return workspace;
+}
+
+// The layers write alternately into the two activations of the workspace
+template <typename Scalar>
+const BasicTensor3D<Scalar>& BasicNetwork<Scalar>::predict(const Tensor& input, Workspace& workspace) const
+{
+	const Tensor* layerInput(&input);
+
+	for (size_t l(0); l < mLayers.size(); ++l) {
+		const Layer& layer(mLayers[l]);
+		Tensor& output(workspace.activations[l % 2]);
+
+		reluConvolution(*layerInput, layer.weights, layer.biases, layer.stride, layer.padding, output, workspace.columns, workspace.products);
+		layerInput = &output;
+	}
+
+	return *layerInput;
+}
+
+// Compute the gradient of the L2 loss averaged over the batch, the gradients of the samples are summed
+// The loss is averaged over batchSize samples, by default the columns of targets, so that the gradients of parts of a batch add up to the gradient of the batch
+template <typename Scalar>
+void BasicNetwork<Scalar>::backward(const std::vector<Tensor>& tensorStack, const Matrix& targets, Vector& gradient, size_t batchSize) const
 {
-	double loss(0);
 	int l(tensorStack.size() - 1);
 
-	weightsGradient.resize(l);
-	biasesGradient.resize(l);
+	if (!batchSize)
+		batchSize = targets.cols();
 
-	std::vector<Tensor3D> deltas;
+	// Keeps its memory from one call to the next, the padding is only written here
+	if (size_t(gradient.size()) != size())
+		gradient.setZero(size());
 
-	for (const Tensor3D& tensor : tensorStack)
-		deltas.push_back(Tensor3D(tensor.height(), tensor.width(), tensor.depth())); // We want the same structure as "predicted" but without copying
+	Tensor deltas(tensorStack[l].height(), tensorStack[l].width(), tensorStack[l].depth(), targets.cols());
 
 	// L2 Loss
-	for (int i(0); i < target.size(); ++i)
-		deltas[l](0, 0, i) = tensorStack[l](0, 0, i) - target(i);
+	for (size_t p(0); p < size_t(targets.cols()); ++p)
+		for (int i(0); i < targets.rows(); ++i)
+			deltas(0, 0, i, p) = (tensorStack[l](0, 0, i, p) - targets(i, p)) / batchSize;
 
 	--l;
 
+	Tensor inputDeltas;
+
 	while (l >= 0) {
-		size_t kernelHeight = mLayers[l].kernels[0].weights.height(),
-			   kernelWidth = mLayers[l].kernels[0].weights.width(),
-			   nbKernels = mLayers[l].kernels.size(),
-			   s = mLayers[l].stride,
-			   p = mLayers[l].padding;
-
-		weightsGradient[l].resize(nbKernels);
-		biasesGradient[l].resize(nbKernels);
-
-		// Compute deltas
-		deltas[l] = deconvolution(deltas[l + 1], mLayers[l].kernels, mLayers[l].stride, mLayers[l].padding);
-
-		for (size_t i(0); i < deltas[l].height(); ++i)
-			for (size_t j(0); j < deltas[l].width(); ++j)
-				for (size_t k(0); k < deltas[l].depth(); ++k)
-					if (tensorStack[l](i, j, k) <= 0)
-						deltas[l](i, j, k) = 0; // ReLU derivative is 0 if the input is <= 0
-
-		// Computing weights gradient
-		for (size_t k(0); k < deltas[l + 1].depth(); ++k) {
-			weightsGradient[l][k] = Tensor3D(kernelHeight, kernelWidth, deltas[l].depth());
-
-			for (size_t i(0); i < deltas[l + 1].height(); ++i) {
-				for (size_t j(0); j < deltas[l + 1].width(); ++j) {
-					for (size_t m(0); m < kernelHeight; ++m) {
-						for (size_t n(0); n < kernelWidth; ++n) {
-							int x = i * s + m - p,
-								y = j * s + n - p;
-
-							if (x < 0 || x >= deltas[l].height() || y < 0 || y >= deltas[l].width())
-								continue;
-
-							for (size_t c(0); c < deltas[l].depth(); ++c)
-								weightsGradient[l][k](m, n, c) += deltas[l + 1](i, j, k) * std::max(tensorStack[l](x, y, c), 0.0);
-						}
-					}
-				}
-			}
-		}
-
-		// Computing biases gradient
-		for (size_t k(0); k < deltas[l + 1].depth(); ++k) {
-			biasesGradient[l][k] = 0;
-
-			for (size_t i(0); i < deltas[l + 1].height(); ++i)
-				for (size_t j(0); j < deltas[l + 1].width(); ++j)
-					biasesGradient[l][k] += deltas[l + 1](i, j, k);
-		}
+		const Layer& layer(mLayers[l]);
 
+		// Computing weights and biases gradients, and the deltas of the layer input (masked by the ReLU derivative) except for the input of the network
+		reluConvolutionBackward(tensorStack[l], deltas, layer.weights, layer.stride, layer.padding, gradient.data() + (layer.weights.data() - data()),
+								gradient.data() + (layer.biases.data() - data()), l ? &inputDeltas : nullptr);
+
+		std::swap(deltas, inputDeltas);
 		--l;
 	}
 }
 
-void Network::applyGradient(const std::vector<std::vector<Tensor3D>>& weightsGrad, const std::vector<std::vector<double>>& biasesGrad, double learningRate, double momentumTerm, double epsilon)
+template <typename Scalar>
+void BasicNetwork<Scalar>::applyGradient(const Vector& gradient, Optimizer& optimizer)
 {
-	for (size_t l(0); l < mLayers.size(); ++l) {
-		size_t kernelHeight = mLayers[l].kernels[0].weights.height(),
-			   kernelWidth = mLayers[l].kernels[0].weights.width(),
-			   kernelDepth = mLayers[l].kernels[0].weights.depth(),
-			   nbKernels = mLayers[l].kernels.size();
-
-		for (size_t k(0); k < nbKernels; ++k) {
-			_update(mLayers[l].kernels[k].bias, mLayers[l].kernels[k].biasAvgGrad, biasesGrad[l][k], learningRate, momentumTerm, epsilon);
-
-			for (size_t m(0); m < kernelHeight; ++m)
-				for (size_t n(0); n < kernelWidth; ++n)
-					for (size_t c(0); c < kernelDepth; ++c)
-						_update(mLayers[l].kernels[k].weights(m, n, c), mLayers[l].kernels[k].weightsAvgGrad(m, n, c), weightsGrad[l][k](m, n, c), learningRate, momentumTerm, epsilon);
-		}
-	}
+	optimizer.update(segments(), gradient.data());
+}
+
+template <typename Scalar>
+std::vector<typename BasicOptimizer<Scalar>::Segment> BasicNetwork<Scalar>::segments()
+{
+	return { { mParameters.data(), mParameters.size() } };
 }
 
-void Network::addLayer(size_t nbKernels, size_t kernelHeight, size_t kernelWidth, size_t kernelChannels, size_t stride, size_t padding)
+template <typename Scalar>
+size_t BasicNetwork<Scalar>::parameters() const
 {
-	mLayers.push_back({ std::vector<Kernel>(nbKernels, { Tensor3D(kernelHeight, kernelWidth, kernelChannels), 0.0 }), stride, padding });
+	size_t count(0);
 
+	for (const Layer& layer : mLayers)
+		count += layer.weights.size() + layer.biases.size();
 
-	std::mt19937 generator(std::random_device{}());
+	return count;
+}
+
+template <typename Scalar>
+void BasicNetwork<Scalar>::addLayer(size_t nbKernels, size_t kernelHeight, size_t kernelWidth, size_t kernelChannels, size_t stride, size_t padding, bool initialize)
+{
+	size_t weightsSize(kernelHeight * kernelWidth * kernelChannels * nbKernels);
+
+	// The layers are copied if mLayers grows (Eigen maps cannot be moved without exceptions), so the parameters they view must still be there
+	// Until they are bound to the grown parameters, the layers only give their shapes
+	mLayers.push_back({ Tensor(kernelHeight, kernelWidth, kernelChannels, nbKernels), typename Tensor::VectorMap(nullptr, 0), stride, padding });
+	mParameters.resize(mParameters.size() + _aligned(weightsSize) + _aligned(nbKernels), Scalar(0));
+	_bind(mLayers);
+
+	if (!initialize)
+		return;
+
+	Random& random(Random::local());
 	std::normal_distribution<double> rand(0.0, 1.0);
 
-	for (int k(0); k < nbKernels; ++k)
-		for (size_t m(0); m < kernelHeight; ++m)
-			for (size_t n(0); n < kernelWidth; ++n)
-				for (size_t c(0); c < kernelChannels; ++c)
-					mLayers.back().kernels[k].weights(m, n, c) = rand(generator) * (2.0 / double(kernelHeight * kernelWidth * kernelChannels));
+	for (size_t i(0); i < mLayers.back().weights.size(); ++i)
+		mLayers.back().weights.data()[i] = Scalar(rand(random) * (2.0 / double(kernelHeight * kernelWidth * kernelChannels)));
 }
 
-Layer& Network::layer(size_t l)
+template <typename Scalar>
+typename BasicNetwork<Scalar>::Layer& BasicNetwork<Scalar>::layer(size_t l)
 {
 	return mLayers[l];
 }
 
-const Layer& Network::layer(size_t l) const
+template <typename Scalar>
+const typename BasicNetwork<Scalar>::Layer& BasicNetwork<Scalar>::layer(size_t l) const
 {
-	return const_cast<Network*>(this)->layer(l);
+	return const_cast<BasicNetwork*>(this)->layer(l);
 }
 
-size_t Network::layers() const
+template <typename Scalar>
+size_t BasicNetwork<Scalar>::layers() const
 {
 	return mLayers.size();
 }
 
-void Network::_update(double& x, double& avgGrad, double grad, double learningRate, double momentumTerm, double epsilon)
+template <typename Scalar>
+Scalar* BasicNetwork<Scalar>::data()
+{
+	return mParameters.data();
+}
+
+template <typename Scalar>
+const Scalar* BasicNetwork<Scalar>::data() const
 {
-	avgGrad = momentumTerm * avgGrad + (1 - momentumTerm) * grad * grad;
-	x -= learningRate / std::sqrt(avgGrad + epsilon) * grad;
+	return mParameters.data();
 }
+
+template <typename Scalar>
+size_t BasicNetwork<Scalar>::size() const
+{
+	return mParameters.size();
+}
+
+template <typename Scalar>
+void BasicNetwork<Scalar>::copyParameters(const BasicNetwork& other)
+{
+	if (other.size() != size() || other.layers() != layers())
+		throw std::invalid_argument("Network: cannot copy the parameters of a different network");
+
+	std::copy(other.mParameters.begin(), other.mParameters.end(), mParameters.begin());
+}
+
+// The layers keep viewing the parameters they were given, only the buffers change hands
+template <typename Scalar>
+void BasicNetwork<Scalar>::swap(BasicNetwork& other)
+{
+	mParameters.swap(other.mParameters);
+	mLayers.swap(other.mLayers);
+}
+
+// Layers with the shapes, strides and paddings of the given ones, viewing their place in the parameters
+template <typename Scalar>
+void BasicNetwork<Scalar>::_bind(const std::vector<Layer>& shapes)
+{
+	std::vector<Layer> layers;
+	Scalar* parameters(mParameters.data());
+
+	layers.reserve(shapes.size());
+
+	for (const Layer& shape : shapes) {
+		const Tensor& weights(shape.weights);
+		Scalar* biases(parameters + _aligned(weights.size()));
+
+		layers.push_back({ Tensor(parameters, weights.height(), weights.width(), weights.depth(), weights.batch()),
+						   typename Tensor::VectorMap(biases, weights.batch()), shape.stride, shape.padding });
+
+		parameters = biases + _aligned(weights.batch());
+	}
+
+	mLayers.swap(layers);
+}
+
+template <typename Scalar>
+size_t BasicNetwork<Scalar>::_aligned(size_t size)
+{
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+template class BasicNetwork<float>;
+template class BasicNetwork<double>;
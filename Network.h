@@ -4,23 +4,79 @@
 #include <cmath>
 #include <iostream>
 #include "Tensor3D.h"
+#include "Optimizer.h"
 
-struct Layer
+// The kernels of a layer are the samples of its weights tensor
+// In a network, the weights and the biases are views of its parameters
+template <typename Scalar>
+struct BasicLayer
 {
-	std::vector<Kernel> kernels;
+	BasicTensor3D<Scalar> weights;
+	typename BasicTensor3D<Scalar>::VectorMap biases;
+
 	size_t stride;
 	size_t padding;
 };
 
-class Network
+// Instantiated for float and double in Network.cpp
+template <typename Scalar>
+class BasicNetwork
 {
 public:
-	std::vector<Tensor3D> forward(const Tensor3D&) const;
-	void backward(const std::vector<Tensor3D>&, const Eigen::VectorXd&, std::vector<std::vector<Tensor3D>>&, std::vector<std::vector<double>>&);
+	typedef BasicTensor3D<Scalar> Tensor;
+	typedef typename Tensor::Matrix Matrix;
+	typedef typename Tensor::Vector Vector;
+	typedef BasicLayer<Scalar> Layer;
+	typedef BasicOptimizer<Scalar> Optimizer;
+
+	// Buffers of an inference-only forward pass : the activations of two consecutive layers and the im2col and GEMM buffers
+	// A default workspace grows on its first use
+	struct Workspace
+	{
+		Tensor activations[2];
+		typename Tensor::Buffer columns, products;
+	};
+
+	BasicNetwork() = default;
+	BasicNetwork(const BasicNetwork&);
+	BasicNetwork(BasicNetwork&&) = default;
+	BasicNetwork& operator=(const BasicNetwork&);
+	BasicNetwork& operator=(BasicNetwork&&) = default;
+
+	std::vector<Tensor> forward(const Tensor&) const;
+
+	// Workspace large enough for inputs of the given height, width and batch size
+	Workspace workspace(size_t, size_t, size_t = 1) const;
+
+	// Forward pass without keeping the activations, the output lives in the workspace until its next use
+	// For a single state nothing is allocated, larger batches may still have Eigen allocate its GEMM blocks
+	const Tensor& predict(const Tensor&, Workspace&) const;
 
-	void applyGradient(const std::vector<std::vector<Tensor3D>>&, const std::vector<std::vector<double>>&, double, double, double);
+	// Gradients are flat and laid out like the parameters
+	void backward(const std::vector<Tensor>&, const Matrix&, Vector&, size_t = 0) const;
+	void applyGradient(const Vector&, Optimizer&);
 
-	void addLayer(size_t, size_t, size_t, size_t, size_t, size_t);
+	// The whole parameter buffer, as a single segment
+	std::vector<typename Optimizer::Segment> segments();
+
+	// Number of weights and biases
+	size_t parameters() const;
+
+	// All the parameters in a single buffer : the weights then the biases of each layer, each one starting on a multiple of alignment scalars
+	// The padding is 0, size() counts it
+	Scalar* data();
+	const Scalar* data() const;
+	size_t size() const;
+
+	// Parameters of a network with the same layers, nothing is allocated
+	void copyParameters(const BasicNetwork&);
+	void swap(BasicNetwork&);
+
+	static const size_t alignment = 16;
+
+	// Kernels, kernel height, kernel width, kernel depth, stride and padding
+	// The weights are drawn from the stream of the thread unless initialize is false, then they are 0 until written, as when a checkpoint is loaded
+	void addLayer(size_t, size_t, size_t, size_t, size_t, size_t, bool = true);
 
 	Layer& layer(size_t);
 	const Layer& layer(size_t) const;
@@ -28,9 +84,14 @@ public:
 	size_t layers() const;
 
 private:
-	void _update(double&, double&, double, double, double, double);
+	void _bind(const std::vector<Layer>&);
+	static size_t _aligned(size_t);
 
+	typename Tensor::Buffer mParameters;
 	std::vector<Layer> mLayers;
 };
 
+typedef BasicLayer<Real> Layer;
+typedef BasicNetwork<Real> Network;
+
 #endif // NETWORK_H
@@ -0,0 +1,106 @@
+#include "Optimizer.h"
+
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+	const size_t blockSize = 1024;
+}
+
+template <typename Scalar>
+BasicOptimizer<Scalar>::BasicOptimizer(const OptimizerSettings& settings) :
+	mSettings(settings),
+	mSteps(0)
+{
+}
+
+template <typename Scalar>
+void BasicOptimizer<Scalar>::update(const std::vector<Segment>& segments, const Scalar* gradient)
+{
+	size_t parameters(0);
+
+	for (const Segment& segment : segments)
+		parameters += segment.second;
+
+	// Zero moments, Adam needs both
+	if (!mSteps) {
+		mSecondMoments.assign(parameters, Scalar(0));
+
+		if (mSettings.type == OptimizerType::Adam)
+			mFirstMoments.assign(parameters, Scalar(0));
+	}
+
+	if (parameters != mSecondMoments.size())
+		throw std::invalid_argument("Optimizer: the number of parameters changed");
+
+	++mSteps;
+
+	Scalar* firstMoments(mFirstMoments.data());
+	Scalar* secondMoments(mSecondMoments.data());
+
+	if (mSettings.type == OptimizerType::RMSProp) {
+		for (const Segment& segment : segments) {
+			rmsProp(segment.first, secondMoments, gradient, segment.second, Scalar(mSettings.learningRate), Scalar(mSettings.momentumTerm), Scalar(mSettings.epsilon));
+
+			secondMoments += segment.second;
+			gradient += segment.second;
+		}
+	} else {
+		double stepSize(mSettings.learningRate * std::sqrt(1.0 - std::pow(mSettings.beta2, double(mSteps))) / (1.0 - std::pow(mSettings.beta1, double(mSteps))));
+
+		for (const Segment& segment : segments) {
+			adam(segment.first, firstMoments, secondMoments, gradient, segment.second, Scalar(stepSize), Scalar(mSettings.beta1), Scalar(mSettings.beta2), Scalar(mSettings.epsilon));
+
+			firstMoments += segment.second;
+			secondMoments += segment.second;
+			gradient += segment.second;
+		}
+	}
+}
+
+template <typename Scalar>
+const OptimizerSettings& BasicOptimizer<Scalar>::settings() const
+{
+	return mSettings;
+}
+
+template <typename Scalar>
+size_t BasicOptimizer<Scalar>::steps() const
+{
+	return mSteps;
+}
+
+template <typename Scalar>
+void BasicOptimizer<Scalar>::rmsProp(Scalar* x, Scalar* v, const Scalar* g, size_t count, Scalar learningRate, Scalar momentumTerm, Scalar epsilon)
+{
+	typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> Array;
+
+	for (size_t first(0); first < count; first += blockSize) {
+		Eigen::Index size(std::min(blockSize, count - first));
+		Eigen::Map<Array> parameters(x + first, size), squares(v + first, size);
+		Eigen::Map<const Array> gradient(g + first, size);
+
+		squares = momentumTerm * squares + (1 - momentumTerm) * gradient.square();
+		parameters -= learningRate / (squares + epsilon).sqrt() * gradient;
+	}
+}
+
+template <typename Scalar>
+void BasicOptimizer<Scalar>::adam(Scalar* x, Scalar* m, Scalar* v, const Scalar* g, size_t count, Scalar stepSize, Scalar beta1, Scalar beta2, Scalar epsilon)
+{
+	typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> Array;
+
+	for (size_t first(0); first < count; first += blockSize) {
+		Eigen::Index size(std::min(blockSize, count - first));
+		Eigen::Map<Array> parameters(x + first, size), means(m + first, size), squares(v + first, size);
+		Eigen::Map<const Array> gradient(g + first, size);
+
+		means = beta1 * means + (1 - beta1) * gradient;
+		squares = beta2 * squares + (1 - beta2) * gradient.square();
+		parameters -= stepSize * means / (squares.sqrt() + epsilon);
+	}
+}
+
+template class BasicOptimizer<float>;
+template class BasicOptimizer<double>;
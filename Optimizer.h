@@ -0,0 +1,55 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <vector>
+#include <utility>
+#include "Tensor3D.h"
+
+enum class OptimizerType { RMSProp, Adam };
+
+// RMSProp uses momentumTerm as the decay of the squared gradients, Adam uses beta1 and beta2
+struct OptimizerSettings
+{
+	OptimizerType type = OptimizerType::RMSProp;
+	double learningRate = 0.00025;
+	double momentumTerm = 0.95;
+	double beta1 = 0.9;
+	double beta2 = 0.999;
+	double epsilon = 1e-8;
+};
+
+// Update rules over flat arrays of parameters, gradients and moments, the moments being owned by the optimizer
+// Each update goes through the arrays once : they are processed in blocks small enough for every expression of a block to run from the L1 cache
+// Instantiated for float and double in Optimizer.cpp
+template <typename Scalar>
+class BasicOptimizer
+{
+public:
+	typedef std::pair<Scalar*, size_t> Segment; // Parameters and their number
+
+	BasicOptimizer(const OptimizerSettings& = OptimizerSettings());
+
+	// The gradient holds the gradients of all the segments, one after the other
+	// The moments are sized on the first update and must then always be given the same number of parameters
+	void update(const std::vector<Segment>&, const Scalar*);
+
+	const OptimizerSettings& settings() const;
+	size_t steps() const;
+
+	// x -= learningRate / sqrt(v + epsilon) * g, with v = momentumTerm * v + (1 - momentumTerm) * g^2
+	static void rmsProp(Scalar*, Scalar*, const Scalar*, size_t, Scalar, Scalar, Scalar);
+
+	// x -= stepSize * m / (sqrt(v) + epsilon), with m = beta1 * m + (1 - beta1) * g and v = beta2 * v + (1 - beta2) * g^2
+	// The bias correction is folded into the step size
+	static void adam(Scalar*, Scalar*, Scalar*, const Scalar*, size_t, Scalar, Scalar, Scalar, Scalar);
+
+private:
+	OptimizerSettings mSettings;
+	size_t mSteps;
+
+	typename BasicTensor3D<Scalar>::Buffer mFirstMoments, mSecondMoments;
+};
+
+typedef BasicOptimizer<Real> Optimizer;
+
+#endif // OPTIMIZER_H
@@ -0,0 +1,90 @@
+#include "Random.h"
+
+#include <mutex>
+#include <random>
+
+namespace
+{
+	std::mutex seedMutex;
+	bool isSeeded(false);
+	uint64_t runSeed(0);
+	uint64_t nextStream(0);
+
+	uint64_t splitmix64(uint64_t& x)
+	{
+		uint64_t z(x += 0x9E3779B97F4A7C15);
+
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+
+		return z ^ (z >> 31);
+	}
+
+	// Called with seedMutex held
+	uint64_t currentSeed()
+	{
+		if (!isSeeded) {
+			std::random_device device;
+			runSeed = uint64_t(device()) << 32 | device();
+			isSeeded = true;
+		}
+
+		return runSeed;
+	}
+}
+
+Random::Random()
+{
+	uint64_t seed, stream;
+
+	{
+		std::lock_guard<std::mutex> lock(seedMutex);
+		seed = currentSeed();
+		stream = nextStream++;
+	}
+
+	*this = Random(seed, stream);
+}
+
+// The parent state is hashed instead of drawn from, so that it is left as is
+Random Random::stream(uint64_t k) const
+{
+	uint64_t x(mState[0] ^ _rotate(mState[1], 17) ^ _rotate(mState[2], 31) ^ _rotate(mState[3], 47));
+
+	return Random(splitmix64(x), k);
+}
+
+Random::Random(uint64_t seed, uint64_t stream)
+{
+	uint64_t x(seed ^ splitmix64(stream));
+
+	for (uint64_t& s : mState)
+		s = splitmix64(x);
+}
+
+void Random::uniforms(double* values, size_t n)
+{
+	for (size_t i(0); i < n; ++i)
+		values[i] = uniform();
+}
+
+void Random::setSeed(uint64_t seed)
+{
+	std::lock_guard<std::mutex> lock(seedMutex);
+
+	runSeed = seed;
+	isSeeded = true;
+	nextStream = 0;
+}
+
+uint64_t Random::seed()
+{
+	std::lock_guard<std::mutex> lock(seedMutex);
+	return currentSeed();
+}
+
+Random& Random::local()
+{
+	thread_local Random random;
+	return random;
+}
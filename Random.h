@@ -0,0 +1,76 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Stream of random numbers : a xoshiro256** generator, 32 bytes of state and a few instructions per number
+// Every stream comes from the seed of the run, the state being expanded with splitmix64 so that streams do not overlap in practice
+// Streams created without a parent are numbered in the order of creation, so a run with the same seed that creates its components in the same order draws the same numbers
+// Random is a UniformRandomBitGenerator, the standard distributions work with it
+class Random
+{
+public:
+	typedef uint64_t result_type;
+
+	Random(); // Next stream of the run
+
+	// Stream k of this one, without drawing from it : the same k always gives the same stream, whatever the thread asking for it
+	Random stream(uint64_t) const;
+
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return ~result_type(0); }
+	result_type operator()();
+
+	double uniform(); // In [0, 1)
+	size_t uniform(size_t); // In [0, n)
+	void uniforms(double*, size_t); // n values in [0, 1) at once
+
+	// Seed of the run, drawn from std::random_device unless it was set
+	// Setting it restarts the numbering of the streams, so it is set before any component is created
+	static void setSeed(uint64_t);
+	static uint64_t seed();
+
+	// Stream of the calling thread, created on its first use
+	static Random& local();
+
+private:
+	Random(uint64_t, uint64_t);
+
+	static uint64_t _rotate(uint64_t, int);
+
+	uint64_t mState[4];
+};
+
+inline uint64_t Random::_rotate(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+inline Random::result_type Random::operator()()
+{
+	uint64_t result(_rotate(mState[1] * 5, 7) * 9), t(mState[1] << 17);
+
+	mState[2] ^= mState[0];
+	mState[3] ^= mState[1];
+	mState[1] ^= mState[2];
+	mState[0] ^= mState[3];
+	mState[2] ^= t;
+	mState[3] = _rotate(mState[3], 45);
+
+	return result;
+}
+
+// The 53 high bits make the mantissa
+inline double Random::uniform()
+{
+	return double((*this)() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// The bias is below 2^-53 n, nothing for the sizes drawn here
+inline size_t Random::uniform(size_t n)
+{
+	return size_t(uniform() * double(n));
+}
+
+#endif // RANDOM_H
@@ -1,93 +1,424 @@
 #include "ReplayMemory.h"
 
+#include <fstream>
+#include <stdexcept>
+
+namespace
+{
+	// Header of a replay memory file, the slots start at slotsOffset
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t height, width, slots;
+		uint64_t pos, hasPending;
+	};
+
+	const uint32_t fileMagic = 0x524B4E53; // "SNKR"
+	const uint32_t fileVersion = 1;
+	const size_t slotsOffset = 64;
+
+	const size_t rebuildChunk = 65536; // Leaves set at once when the sum tree is rebuilt
+}
+
 Transition::Transition()
 {
 }
 
 Transition::Transition(Game& g, Direction a)
 {
-	state = g.state();
+	g.state(state);
 	action = a;
 	reward = g.nextState(a);
-	nextState = g.state();
+	g.state(nextState);
 	isTerminal = g.isFinished();
 }
 
 
-Node::Node() : transition(nullptr), value(0.0)
+ReplayMemory::ReplayMemory(size_t leaves) :
+	mPriorities(leaves),
+	mGenerations(leaves),
+	mPos(0),
+	mSize(0),
+	mHeight(0),
+	mWidth(0),
+	mFrameSize(0),
+	mSlotSize(0),
+	mSlots(nullptr),
+	mHasPending(false)
 {
 }
 
-ReplayMemory::ReplayMemory(size_t leaves)
+// The header is checked before the file is mapped, so that a file of something else is never grown
+ReplayMemory::ReplayMemory(const std::string& path, size_t leaves, size_t height, size_t width) :
+	mPriorities(leaves),
+	mGenerations(leaves),
+	mPos(0),
+	mSize(0),
+	mHeight(0),
+	mWidth(0),
+	mFrameSize(0),
+	mSlotSize(0),
+	mSlots(nullptr),
+	mHasPending(false)
 {
-	size_t size = std::pow(2, std::ceil(std::log2(leaves))) + leaves - 1;
-	mNodes = std::vector<Node>(size);
-	mFirstLeaf = size - leaves;
-	
-	mPos = mFirstLeaf;
+	FileHeader header = {};
+	std::ifstream existing(path, std::ios::binary);
+
+	if (existing.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+		if (header.magic != fileMagic || header.version != fileVersion)
+			throw std::runtime_error("ReplayMemory: " + path + " is not a replay memory");
+
+		if (header.height != height || header.width != width || header.slots != leaves)
+			throw std::runtime_error("ReplayMemory: " + path + " holds a replay memory of another shape");
+	}
+
+	existing.close();
+
+	_setShape(height, width);
+	mFile.reset(new MappedFile(path, slotsOffset + leaves * mSlotSize));
+	mSlots = reinterpret_cast<uint8_t*>(mFile->data()) + slotsOffset;
+
+	FileHeader& mapped(*reinterpret_cast<FileHeader*>(mFile->data()));
+
+	// A new file is all zeros, as are its priorities
+	if (mapped.magic != fileMagic) {
+		mapped = { fileMagic, fileVersion, height, width, leaves, 0, 0 };
+		return;
+	}
+
+	mPos = size_t(mapped.pos);
+	mHasPending = mapped.hasPending != 0;
+	_rebuildPriorities();
 }
 
-ReplayMemory::~ReplayMemory()
+void ReplayMemory::push(const Transition& t, double priority)
 {
-	for (Node& node : mNodes)
-		delete node.transition;
+	std::lock_guard<std::mutex> lock(mMutex);
+	_push(t, priority);
 }
 
-void ReplayMemory::push(Transition* t, double priority)
+void ReplayMemory::push(const Transition* transitions, size_t n, double priority)
 {
-	delete mNodes[mPos].transition;
-	mNodes[mPos].transition = t;
-	setVal(mPos - mFirstLeaf, priority);
+	std::lock_guard<std::mutex> lock(mMutex);
 
-	++mPos;
+	for (size_t i(0); i < n; ++i)
+		_push(transitions[i], priority);
+}
 
-	if (mPos >= mNodes.size())
-		mPos = mFirstLeaf;
+void ReplayMemory::_push(const Transition& t, double priority)
+{
+	size_t slots(mPriorities.size());
+
+	// The frame size of a memory in RAM is known once the first state comes in
+	if (!mFrameSize) {
+		_setShape(t.state.height(), t.state.width());
+		mBuffer.assign(slots * mSlotSize, 0);
+		mSlots = mBuffer.data();
+	}
+
+	if (t.state.height() != mHeight || t.state.width() != mWidth)
+		throw std::invalid_argument("ReplayMemory: the states do not have the shape of the memory");
+
+	_encode(t.state, mFrame.data());
+
+	// Reuse the frame left by the previous transition if it is this state, otherwise only keep it if it is the next state of a non terminal transition
+	if (!mHasPending || std::memcmp(mFrame.data(), _slot(mPos) + FrameField, mFrameSize)) {
+		if (mHasPending && !_slot((mPos + slots - 1) % slots)[TerminalField])
+			mPos = (mPos + 1) % slots;
+
+		_writeFrame(mPos, mFrame.data());
+	}
+
+	float reward(float(t.reward));
+	uint8_t* slot(_slot(mPos));
+
+	std::memcpy(slot + RewardField, &reward, sizeof(float));
+	slot[ActionField] = uint8_t(t.action);
+	slot[TerminalField] = t.isTerminal;
+	_setPriority(mPos, priority);
+	++mSize; // The slot had no transition, its frame was just written or was pending
+
+	mPos = (mPos + 1) % slots;
+
+	_encode(t.nextState, mFrame.data());
+	_writeFrame(mPos, mFrame.data());
+	mHasPending = true;
+
+	_saveRing();
 }
 
-// The user can only update leaves
+// A pending slot has no transition yet, its frame is only the next state of the previous one
 void ReplayMemory::setVal(size_t k, double newVal)
 {
-	size_t i(mFirstLeaf + k % (mNodes.size() - mFirstLeaf));
-	_update(i, newVal - mNodes[i].value);
+	std::lock_guard<std::mutex> lock(mMutex);
+	k %= mPriorities.size();
+
+	if (mHasPending && k == mPos)
+		throw std::invalid_argument("ReplayMemory: the slot only holds the next state of the last transition");
+
+	mSize += (newVal > 0) - (mPriorities.get(k) > 0);
+	_setPriority(k, newVal);
 }
 
+// Slots written since they were sampled are left alone, the transition the priorities were computed for is gone
+// New priorities are expected above 0, they come from the TD errors
+void ReplayMemory::setVals(const TransitionBatch& batch, const std::vector<double>& newVals)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::vector<size_t> leaves;
+	std::vector<double> values;
+
+	for (size_t i(0); i < batch.indices.size(); ++i) {
+		size_t k(batch.indices[i] % mPriorities.size());
+
+		if (mGenerations[k] == batch.generations[i] && mPriorities.get(k) > 0) {
+			leaves.push_back(k);
+			values.push_back(newVals[i]);
+		}
+	}
+
+	mPriorities.set(leaves, values);
+
+	for (size_t i(0); i < leaves.size(); ++i) {
+		float priority(float(values[i]));
+		std::memcpy(_slot(leaves[i]) + PriorityField, &priority, sizeof(float));
+	}
+}
+
+// Stratified sampling : one transition in each of the n segments of the total priority
 std::vector<size_t> ReplayMemory::sample(size_t n) const
 {
-	std::vector<size_t> batch(n);
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::vector<size_t> leaves;
+
+	mUniforms.resize(n);
+	mRandom.uniforms(mUniforms.data(), n);
+	mPriorities.sample(mUniforms, leaves);
+
+	return leaves;
+}
+
+// Sample and unpack at once, so that no transition can be overwritten in between
+void ReplayMemory::sample(size_t n, TransitionBatch& batch) const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	mUniforms.resize(n);
+	mRandom.uniforms(mUniforms.data(), n);
+	mPriorities.sample(mUniforms, batch.indices);
+	_unpack(batch.indices, batch.states, batch.nextStates);
+
+	batch.generations.resize(n);
+	batch.actions.resize(n);
+	batch.rewards.resize(n);
+	batch.isTerminal.resize(n);
+
+	for (size_t p(0); p < n; ++p) {
+		const uint8_t* slot(_slot(batch.indices[p]));
+
+		batch.generations[p] = mGenerations[batch.indices[p]];
+		batch.actions[p] = Direction(slot[ActionField]);
+		batch.rewards[p] = _float(batch.indices[p], RewardField);
+		batch.isTerminal[p] = slot[TerminalField] != 0;
+	}
+}
+
+// Unpack a transition, the next state of a terminal transition is not kept
+Transition ReplayMemory::operator[](size_t k) const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	Transition t;
+
+	k %= mPriorities.size();
+	_unpack({ k }, t.state, t.nextState);
+
+	t.action = Direction(_slot(k)[ActionField]);
+	t.reward = _float(k, RewardField);
+	t.isTerminal = _slot(k)[TerminalField] != 0;
+
+	return t;
+}
 
-	std::mt19937 generator(std::random_device{}());
-	std::uniform_real_distribution<double> distribution(0.0, mNodes[0].value);
+void ReplayMemory::decode(const std::vector<size_t>& batch, Tensor3D& states, Tensor3D& nextStates) const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	_unpack(batch, states, nextStates);
+}
 
-	for (size_t& k : batch)
-		k = _retrieve(0, distribution(generator));
+Direction ReplayMemory::action(size_t k) const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return Direction(_slot(k % mPriorities.size())[ActionField]);
+}
 
-	return batch;
+double ReplayMemory::reward(size_t k) const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return _float(k % mPriorities.size(), RewardField);
 }
 
-// Access a leaf node
-const Node & ReplayMemory::operator[](size_t k) const
+bool ReplayMemory::isTerminal(size_t k) const
 {
-	return mNodes[mFirstLeaf + k % (mNodes.size() - mFirstLeaf)];
+	std::lock_guard<std::mutex> lock(mMutex);
+	return _slot(k % mPriorities.size())[TerminalField] != 0;
 }
 
-// Recursive function
-void ReplayMemory::_update(size_t k, double delta)
+// Average footprint of a slot, sum tree and write counter included, whether the slots are in RAM or in a file
+size_t ReplayMemory::bytesPerTransition() const
 {
-	mNodes[k].value += delta;
+	std::lock_guard<std::mutex> lock(mMutex);
+	size_t bytes(mPriorities.bytes() + mPriorities.size() * (mSlotSize + sizeof(uint32_t)));
 
-	// If we are not updating the root node, update parent (sum heap)
-	if (k)
-		_update((k - 1) / 2, delta);
+	return bytes / mPriorities.size();
 }
 
-size_t ReplayMemory::_retrieve(size_t n, double sum) const
+size_t ReplayMemory::size() const
 {
-	if (n >= mFirstLeaf)
-		return n - mFirstLeaf;
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mSize;
+}
+
+size_t ReplayMemory::capacity() const
+{
+	return mPriorities.size();
+}
+
+// Root of the sum tree
+double ReplayMemory::totalPriority() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mPriorities.total();
+}
+
+// The sum tree has 2 nodes per leaf, the leaves being rounded up to a power of 2
+// Every power of 2 is tried as the number of leaves, with as many slots as fit next to its tree
+size_t ReplayMemory::capacityFor(size_t bytes, size_t height, size_t width)
+{
+	size_t slotBytes(FrameField + (height * width + 3) / 4 + sizeof(uint32_t)), capacity(0);
+
+	for (size_t leaves(1); 2 * leaves * sizeof(double) <= bytes; leaves *= 2)
+		capacity = std::max(capacity, std::min(leaves, (bytes - 2 * leaves * sizeof(double)) / slotBytes));
+
+	return capacity;
+}
+
+void ReplayMemory::_setShape(size_t height, size_t width)
+{
+	mHeight = height;
+	mWidth = width;
+	mFrameSize = (mHeight * mWidth + 3) / 4;
+	mSlotSize = FrameField + mFrameSize;
+	mFrame.resize(mFrameSize);
+}
+
+// The leaves are set a chunk at a time, so that the ancestors they share are computed once without listing every leaf
+void ReplayMemory::_rebuildPriorities()
+{
+	std::vector<size_t> leaves;
+	std::vector<double> values;
+
+	for (size_t k(0); k < mPriorities.size(); ++k) {
+		double priority(_float(k, PriorityField));
+
+		if (priority > 0) {
+			leaves.push_back(k);
+			values.push_back(priority);
+			++mSize;
+		}
+
+		if (leaves.size() == rebuildChunk || k + 1 == mPriorities.size()) {
+			mPriorities.set(leaves, values);
+			leaves.clear();
+			values.clear();
+		}
+	}
+}
+
+// The position of the ring is written after the slots it refers to
+void ReplayMemory::_saveRing()
+{
+	if (!mFile)
+		return;
+
+	FileHeader& header(*reinterpret_cast<FileHeader*>(mFile->data()));
+
+	header.pos = mPos;
+	header.hasPending = mHasPending;
+}
+
+uint8_t* ReplayMemory::_slot(size_t k)
+{
+	return mSlots + k * mSlotSize;
+}
+
+const uint8_t* ReplayMemory::_slot(size_t k) const
+{
+	return mSlots + k * mSlotSize;
+}
+
+// Slots are packed, so their floats are not aligned
+float ReplayMemory::_float(size_t k, SlotField field) const
+{
+	float value;
+	std::memcpy(&value, _slot(k) + field, sizeof(float));
+
+	return value;
+}
+
+// The priority is kept in the slot as well, for the sum tree to be rebuilt when a file is reopened
+void ReplayMemory::_setPriority(size_t k, double priority)
+{
+	float value(static_cast<float>(priority));
+
+	mPriorities.set(k, priority);
+	std::memcpy(_slot(k) + PriorityField, &value, sizeof(float));
+}
+
+void ReplayMemory::_unpack(const std::vector<size_t>& batch, Tensor3D& states, Tensor3D& nextStates) const
+{
+	size_t slots(mPriorities.size());
+
+	states = Tensor3D(mHeight, mWidth, 1, batch.size());
+	nextStates = Tensor3D(mHeight, mWidth, 1, batch.size());
+
+	for (size_t p(0); p < batch.size(); ++p) {
+		size_t k(batch[p] % slots);
+
+		_decode(_slot(k) + FrameField, states.data() + p * states.sampleSize());
+
+		if (!_slot(k)[TerminalField])
+			_decode(_slot((k + 1) % slots) + FrameField, nextStates.data() + p * nextStates.sampleSize());
+	}
+}
+
+// Cells are quantized to the values produced by Game::state : 0 (empty), 0.299 (apple) or 1 (body)
+void ReplayMemory::_encode(const Tensor3D& state, uint8_t* frame) const
+{
+	std::fill_n(frame, mFrameSize, 0);
+
+	for (size_t i(0); i < mHeight * mWidth; ++i) {
+		uint8_t cell(state.data()[i] >= 1.0 ? Body : (state.data()[i] > 0.0 ? Apple : Empty));
+		frame[i / 4] |= cell << (2 * (i % 4));
+	}
+}
+
+void ReplayMemory::_decode(const uint8_t* frame, Real* state) const
+{
+	static const Real values[4] = { Real(0.0), Real(0.299), Real(1.0), Real(0.0) };
+
+	for (size_t i(0); i < mHeight * mWidth; ++i)
+		state[i] = values[(frame[i / 4] >> (2 * (i % 4))) & 3];
+}
+
+// Whatever transition used the slot is gone
+void ReplayMemory::_writeFrame(size_t k, const uint8_t* frame)
+{
+	std::copy_n(frame, mFrameSize, _slot(k) + FrameField);
+	++mGenerations[k];
+
+	if (mPriorities.get(k) > 0)
+		--mSize;
 
-	if (mNodes[2 * n + 1].value >= sum)
-		return _retrieve(2 * n + 1, sum); // 2n + 1 is the index of the left child of the node at index n
-	else
-		return _retrieve(2 * n + 2, sum - mNodes[2 * n + 1].value);
+	_setPriority(k, 0.0);
 }
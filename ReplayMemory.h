@@ -2,8 +2,16 @@
 #define REPLAYMEMORY_H
 
 #include <numeric>
+#include <cstdint>
+#include <cstring>
 #include <unordered_set>
+#include <mutex>
+#include <memory>
+#include <string>
 #include "Game.h"
+#include "SumTree.h"
+#include "MappedFile.h"
+#include "Random.h"
 
 struct Transition
 {
@@ -17,34 +25,103 @@ struct Transition
 	bool isTerminal;
 };
 
-struct Node
+// Sampled transitions, unpacked
+struct TransitionBatch
 {
-	Node();
-
-	double value;
-	Transition* transition;
+	std::vector<size_t> indices;
+	std::vector<uint32_t> generations; // Of the sampled slots, for the new priorities to skip the slots written since
+	Tensor3D states;
+	Tensor3D nextStates;
+	std::vector<Direction> actions;
+	std::vector<double> rewards;
+	std::vector<bool> isTerminal;
 };
 
+// Transitions are stored in slots holding the packed frame of their state (2 bits per cell : empty, apple or body)
+// The next state of a transition is the frame of the following slot, so consecutive steps of an episode share their frames when they are pushed one after the other
+// A transition whose state is not the last next state pushed takes one more slot, for the next state of the previous transition, unless that one was terminal
+// so the steps of an episode must not be interleaved with those of other episodes : each one goes to a single memory, pushed from a single thread or in blocks
+// A slot whose frame has no transition yet (the last next state pushed) has a priority of 0 and is never sampled
+// Each slot counts its writes in RAM, so that the priorities computed for a sampled transition are not given to the one that replaced it
+// Slots are fixed-size records : reward, priority, action, terminal flag and frame
+// They are kept in RAM, or in a file mapped in memory whose header holds the shape and the position of the ring, the sum tree always being in RAM
+// All the public methods are thread-safe
 class ReplayMemory
 {
 public:
 	ReplayMemory(size_t);
-	~ReplayMemory();
 
-	void push(Transition*, double);
+	// Memory of height x width states in a file, which is reopened if it already holds the slots of a memory of that shape
+	// The priorities kept in the slots rebuild the sum tree, so that sampling goes on where the previous run stopped
+	ReplayMemory(const std::string&, size_t, size_t, size_t);
+
+	void push(const Transition&, double);
+	void push(const Transition*, size_t, double); // n transitions in order, no other push coming in between
 	void setVal(size_t, double);
+	void setVals(const TransitionBatch&, const std::vector<double>&); // Priorities of a sampled batch, one per transition
 
 	std::vector<size_t> sample(size_t) const;
-	
-	const Node& operator[](size_t) const;
+	void sample(size_t, TransitionBatch&) const;
+
+	Transition operator[](size_t) const;
+
+	// Unpack the states and next states of a batch, one sample per transition
+	void decode(const std::vector<size_t>&, Tensor3D&, Tensor3D&) const;
+
+	Direction action(size_t) const;
+	double reward(size_t) const;
+	bool isTerminal(size_t) const;
+
+	size_t bytesPerTransition() const;
+
+	size_t size() const; // Transitions that can be sampled, those with a priority above 0
+	size_t capacity() const;
+	double totalPriority() const;
+
+	// Largest capacity whose memory, sum tree included, fits in the given number of bytes for height x width states
+	// It is counted in slots : when whole episodes are pushed one after the other, they hold as many transitions but the pending next state, and one less per episode cut before its end
+	static size_t capacityFor(size_t, size_t, size_t);
 
 private:
-	void _update(size_t, double);
-	size_t _retrieve(size_t, double) const;
+	enum Cell : uint8_t { Empty, Apple, Body };
+
+	// Offsets in a slot, the frame comes last
+	enum SlotField : size_t { RewardField = 0, PriorityField = 4, ActionField = 8, TerminalField = 9, FrameField = 10 };
 
-	size_t mFirstLeaf;
+	void _push(const Transition&, double);
+
+	void _setShape(size_t, size_t);
+	void _rebuildPriorities();
+	void _saveRing();
+
+	uint8_t* _slot(size_t);
+	const uint8_t* _slot(size_t) const;
+	float _float(size_t, SlotField) const;
+	void _setPriority(size_t, double);
+
+	void _unpack(const std::vector<size_t>&, Tensor3D&, Tensor3D&) const;
+	void _encode(const Tensor3D&, uint8_t*) const;
+	void _decode(const uint8_t*, Real*) const;
+	void _writeFrame(size_t, const uint8_t*);
+
+	SumTree mPriorities;
+	std::vector<uint32_t> mGenerations; // Frames written in each slot
 	size_t mPos;
-	std::vector<Node> mNodes;
+	size_t mSize;
+
+	size_t mHeight, mWidth, mFrameSize, mSlotSize;
+	std::vector<uint8_t> mBuffer; // Slots of a memory in RAM, allocated with the first state
+	std::unique_ptr<MappedFile> mFile; // Header and slots of a memory in a file
+	uint8_t* mSlots;
+
+	bool mHasPending; // mPos holds the next state of the last transition
+	std::vector<uint8_t> mFrame; // Scratch frame
+
+	// Sampling draws from the stream of the memory, whatever the thread
+	mutable Random mRandom;
+	mutable std::vector<double> mUniforms;
+
+	mutable std::mutex mMutex;
 };
 
 #endif // REPLAYMEMORY_H
@@ -0,0 +1,312 @@
+#ifndef STATICNETWORK_H
+#define STATICNETWORK_H
+
+#include <array>
+#include <utility>
+#include <stdexcept>
+#include "Network.h"
+
+// Shape of a layer known at compile time, the kernels having as many channels as the input of the layer
+template <size_t Kernels, size_t KernelHeight, size_t KernelWidth, size_t Stride = 1, size_t Padding = 0>
+struct StaticLayer
+{
+	static const size_t kernels = Kernels;
+	static const size_t kernelHeight = KernelHeight;
+	static const size_t kernelWidth = KernelWidth;
+	static const size_t stride = Stride;
+	static const size_t padding = Padding;
+};
+
+namespace StaticNetworkDetail
+{
+	constexpr size_t maximum(size_t a, size_t b)
+	{
+		return a > b ? a : b;
+	}
+
+	// Same rounding as the parameters of BasicNetwork
+	template <typename Scalar>
+	constexpr size_t aligned(size_t size)
+	{
+		return (size + BasicNetwork<Scalar>::alignment - 1) / BasicNetwork<Scalar>::alignment * BasicNetwork<Scalar>::alignment;
+	}
+
+	// Largest power of 2 dividing size and at most limit
+	constexpr size_t divisor(size_t size, size_t limit)
+	{
+		return limit <= 1 || size % limit == 0 ? limit : divisor(size, limit / 2);
+	}
+
+	// Layers of a network on Height x Width x Depth inputs
+	// Inside the stack, activations are laid out by position, the channels of a position being contiguous : the input of a 1x1 layer is then
+	// already its positions x channels matrix, and the receptive field of a position is made of runs of contiguous channels
+	// The network takes its input and gives its output in the layout of BasicTensor3D
+	// The first layer rectifies the input of the network and the others their own output, like reluConvolution on the input of every layer
+	template <typename Scalar, size_t Height, size_t Width, size_t Depth, bool First, typename... Layers>
+	struct Stack;
+
+	// Past the last layer : the output of the network
+	template <typename Scalar, size_t Height, size_t Width, size_t Depth, bool First>
+	struct Stack<Scalar, Height, Width, Depth, First>
+	{
+		static const size_t outputHeight = Height;
+		static const size_t outputWidth = Width;
+		static const size_t outputDepth = Depth;
+
+		static const size_t size = 0;
+		static const size_t activationSize = 0;
+		static const size_t columnsSize = 0;
+
+		static const Scalar* predict(const Scalar*, const Scalar* input, Scalar*, Scalar*, Scalar*)
+		{
+			return input;
+		}
+
+		static void copyParameters(const BasicNetwork<Scalar>&, size_t, Scalar*)
+		{
+		}
+
+		static bool matches(const BasicNetwork<Scalar>& network, size_t l)
+		{
+			return l == network.layers();
+		}
+
+		static void addLayers(BasicNetwork<Scalar>&)
+		{
+		}
+	};
+
+	template <typename Scalar, size_t Height, size_t Width, size_t Depth, bool First, typename Layer, typename... Layers>
+	struct Stack<Scalar, Height, Width, Depth, First, Layer, Layers...>
+	{
+		static const size_t kernels = Layer::kernels;
+		static const size_t kernelHeight = Layer::kernelHeight;
+		static const size_t kernelWidth = Layer::kernelWidth;
+		static const size_t stride = Layer::stride;
+		static const size_t padding = Layer::padding;
+
+		static_assert(Height + 2 * padding >= kernelHeight && Width + 2 * padding >= kernelWidth, "StaticNetwork: kernels larger than their input");
+
+		static const size_t layerHeight = (Height - kernelHeight + 2 * padding) / stride + 1;
+		static const size_t layerWidth = (Width - kernelWidth + 2 * padding) / stride + 1;
+		static const size_t positions = layerHeight * layerWidth;
+		static const size_t kernelSize = kernelHeight * kernelWidth * Depth;
+
+		static const bool isLast = sizeof...(Layers) == 0;
+
+		// 1x1 kernels multiply the input as it is, the others multiply its unrolled receptive fields
+		static const bool isPointwise = kernelHeight == 1 && kernelWidth == 1 && stride == 1 && padding == 0 && !First;
+
+		// Tiles of the product : tilePositions rows of the output are summed in registers over tileKernels kernels at once,
+		// two of the widest vectors Eigen uses, so that the sums of a tile and one row of weights fit in the registers
+		static const size_t tilePositions = positions % 4 == 0 ? 4 : positions % 3 == 0 ? 3 : positions % 2 == 0 ? 2 : 1;
+		static const size_t tileKernels = divisor(kernels, 2 * EIGEN_MAX_ALIGN_BYTES / sizeof(Scalar));
+
+		typedef Eigen::Array<Scalar, int(tileKernels), 1> Lanes;
+		typedef Stack<Scalar, layerHeight, layerWidth, kernels, false, Layers...> Next;
+
+		static const size_t outputHeight = Next::outputHeight;
+		static const size_t outputWidth = Next::outputWidth;
+		static const size_t outputDepth = Next::outputDepth;
+
+		static const size_t weightsSize = aligned<Scalar>(kernelSize * kernels);
+		static const size_t biasesSize = aligned<Scalar>(kernels);
+
+		static const size_t size = weightsSize + biasesSize + Next::size;
+		static const size_t activationSize = maximum(positions * kernels, Next::activationSize);
+		static const size_t columnsSize = maximum(isPointwise ? 0 : positions * kernelSize, Next::columnsSize);
+
+		// The layers write alternately into output and spare
+		static const Scalar* predict(const Scalar* parameters, const Scalar* input, Scalar* output, Scalar* spare, Scalar* columns)
+		{
+			const Scalar* rows(isPointwise ? input : _unroll(input, columns));
+
+			for (size_t k(0); k < kernels; k += tileKernels)
+				for (size_t p(0); p < positions; p += tilePositions)
+					_tile(rows, parameters, parameters + weightsSize, output, p, k);
+
+			return Next::predict(parameters + weightsSize + biasesSize, output, spare, output, columns);
+		}
+
+		// The weights are stored as a kernelSize x kernels row-major matrix, the rows being in the order of _unroll
+		static void copyParameters(const BasicNetwork<Scalar>& network, size_t l, Scalar* parameters)
+		{
+			const BasicLayer<Scalar>& layer(network.layer(l));
+
+			for (size_t k(0); k < kernels; ++k)
+				for (size_t n(0); n < kernelWidth; ++n)
+					for (size_t m(0); m < kernelHeight; ++m)
+						for (size_t c(0); c < Depth; ++c)
+							parameters[((n * kernelHeight + m) * Depth + c) * kernels + k] = layer.weights(m, n, c, k);
+
+			std::copy_n(layer.biases.data(), kernels, parameters + weightsSize);
+
+			Next::copyParameters(network, l + 1, parameters + weightsSize + biasesSize);
+		}
+
+		static bool matches(const BasicNetwork<Scalar>& network, size_t l)
+		{
+			if (l >= network.layers())
+				return false;
+
+			const BasicLayer<Scalar>& layer(network.layer(l));
+
+			return layer.weights.height() == kernelHeight && layer.weights.width() == kernelWidth && layer.weights.depth() == Depth && layer.weights.batch() == kernels
+				&& layer.stride == stride && layer.padding == padding && Next::matches(network, l + 1);
+		}
+
+		static void addLayers(BasicNetwork<Scalar>& network)
+		{
+			network.addLayer(kernels, kernelHeight, kernelWidth, Depth, stride, padding);
+			Next::addLayers(network);
+		}
+
+		// im2col of a single sample : a positions x kernelSize row-major matrix, whose rows are the receptive fields of the output positions
+		// The zero-padding tests disappear without padding, and after the first layer the channels of each kernel position are a single copy
+		// The first layer reads the input of the network, channel by channel
+		static const Scalar* _unroll(const Scalar* input, Scalar* columns)
+		{
+			Scalar* row(columns);
+
+			for (size_t j(0); j < layerWidth; ++j) {
+				for (size_t i(0); i < layerHeight; ++i) {
+					for (size_t n(0); n < kernelWidth; ++n) {
+						for (size_t m(0); m < kernelHeight; ++m) {
+							int x(int(stride * i + m) - int(padding)),
+								y(int(stride * j + n) - int(padding));
+
+							if (padding && (x < 0 || x >= int(Height) || y < 0 || y >= int(Width)))
+								row = std::fill_n(row, Depth, Scalar(0));
+							else if (First)
+								for (size_t c(0); c < Depth; ++c)
+									*row++ = std::max(input[(c * Width + y) * Height + x], Scalar(0));
+							else
+								row = std::copy_n(input + (y * Height + x) * Depth, Depth, row);
+						}
+					}
+				}
+			}
+
+			return columns;
+		}
+
+		// Rows firstPosition ... firstPosition + tilePositions - 1 and columns firstKernel ... firstKernel + tileKernels - 1 of the output,
+		// with the biases and, except for the last layer, the ReLU of the next layer
+		static void _tile(const Scalar* rows, const Scalar* weights, const Scalar* biases, Scalar* output, size_t firstPosition, size_t firstKernel)
+		{
+			Lanes sums[tilePositions];
+			const Scalar* values(rows + firstPosition * kernelSize);
+
+			for (size_t p(0); p < tilePositions; ++p)
+				sums[p] = Eigen::Map<const Lanes>(biases + firstKernel);
+
+			for (size_t s(0); s < kernelSize; ++s)
+				_accumulate(sums, Eigen::Map<const Lanes>(weights + s * kernels + firstKernel), values + s, std::make_index_sequence<tilePositions>());
+
+			for (size_t p(0); p < tilePositions; ++p) {
+				if (isLast)
+					for (size_t k(0); k < tileKernels; ++k)
+						output[(firstKernel + k) * positions + firstPosition + p] = sums[p](k);
+				else
+					Eigen::Map<Lanes>(output + (firstPosition + p) * kernels + firstKernel) = sums[p].max(Scalar(0));
+			}
+		}
+
+		// One term of every sum of a tile, the positions being unrolled so that the sums stay in registers
+		template <size_t... P>
+		static void _accumulate(Lanes* sums, const Lanes& weights, const Scalar* values, std::index_sequence<P...>)
+		{
+			int unrolled[] = { (sums[P] += values[P * kernelSize] * weights, 0)... };
+			(void)unrolled;
+		}
+	};
+}
+
+// Network whose architecture is a type : the shapes of every layer, activation and buffer are known at compile time,
+// the parameters and the workspace are fixed-size arrays, and every loop and product runs on compile-time sizes
+// It only does inference on one sample at a time, with the parameters of a BasicNetwork of the same layers, which remains the one to train
+// Defined in this header rather than instantiated in a .cpp, every architecture being its own type
+template <typename Scalar, size_t Height, size_t Width, size_t Depth, typename... Layers>
+class BasicStaticNetwork
+{
+	typedef StaticNetworkDetail::Stack<Scalar, Height, Width, Depth, true, Layers...> Stack;
+
+public:
+	typedef BasicTensor3D<Scalar> Tensor;
+
+	static const size_t inputHeight = Height;
+	static const size_t inputWidth = Width;
+	static const size_t inputDepth = Depth;
+	static const size_t outputHeight = Stack::outputHeight;
+	static const size_t outputWidth = Stack::outputWidth;
+	static const size_t outputDepth = Stack::outputDepth;
+
+	// Buffers of a forward pass, small enough to live on the stack
+	struct Workspace
+	{
+		EIGEN_ALIGN_MAX std::array<Scalar, Stack::activationSize> activations[2];
+		EIGEN_ALIGN_MAX std::array<Scalar, Stack::columnsSize> columns;
+	};
+
+	// Parameters at 0
+	BasicStaticNetwork()
+	{
+		mParameters.fill(Scalar(0));
+	}
+
+	explicit BasicStaticNetwork(const BasicNetwork<Scalar>& network) : BasicStaticNetwork()
+	{
+		copyParameters(network);
+	}
+
+	// The network has the layers of this architecture
+	static bool matches(const BasicNetwork<Scalar>& network)
+	{
+		return Stack::matches(network, 0);
+	}
+
+	// Adds the layers of this architecture to a network, usually an empty one
+	static void addLayers(BasicNetwork<Scalar>& network)
+	{
+		Stack::addLayers(network);
+	}
+
+	// The weights are rearranged for the products of the static layers, the padding of the parameters is 0
+	void copyParameters(const BasicNetwork<Scalar>& network)
+	{
+		if (!matches(network))
+			throw std::invalid_argument("StaticNetwork: cannot copy the parameters of a different network");
+
+		Stack::copyParameters(network, 0, mParameters.data());
+	}
+
+	// Forward pass of a single Height x Width x Depth sample, the output lives in the workspace until its next use
+	// It is laid out like a sample of outputHeight x outputWidth x outputDepth tensor
+	const Scalar* predict(const Scalar* input, Workspace& workspace) const
+	{
+		return Stack::predict(mParameters.data(), input, workspace.activations[0].data(), workspace.activations[1].data(), workspace.columns.data());
+	}
+
+	// The tensor must hold a single sample of the input shape
+	const Scalar* predict(const Tensor& input, Workspace& workspace) const
+	{
+		return predict(input.data(), workspace);
+	}
+
+	const Scalar* data() const
+	{
+		return mParameters.data();
+	}
+
+	static size_t size()
+	{
+		return Stack::size;
+	}
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+	EIGEN_ALIGN_MAX std::array<Scalar, Stack::size> mParameters;
+};
+
+#endif // STATICNETWORK_H
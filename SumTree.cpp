@@ -0,0 +1,121 @@
+#include "SumTree.h"
+
+#ifdef _MSC_VER
+#include <xmmintrin.h>
+#define PREFETCH(p) _mm_prefetch(reinterpret_cast<const char*>(p), _MM_HINT_T0)
+#else
+#define PREFETCH(p) __builtin_prefetch(p)
+#endif
+
+SumTree::SumTree(size_t size) :
+	mSize(size),
+	mFirstLeaf(1)
+{
+	while (mFirstLeaf < size)
+		mFirstLeaf *= 2;
+
+	mNodes.assign(2 * mFirstLeaf, 0.0);
+}
+
+size_t SumTree::size() const
+{
+	return mSize;
+}
+
+size_t SumTree::bytes() const
+{
+	return mNodes.size() * sizeof(double);
+}
+
+double SumTree::total() const
+{
+	return mNodes[1];
+}
+
+double SumTree::get(size_t k) const
+{
+	return mNodes[mFirstLeaf + k];
+}
+
+void SumTree::set(size_t k, double value)
+{
+	size_t i(mFirstLeaf + k);
+	mNodes[i] = value;
+
+	// Parents are recomputed from their children so that rounding errors do not pile up
+	for (i /= 2; i; i /= 2)
+		mNodes[i] = mNodes[2 * i] + mNodes[2 * i + 1];
+}
+
+void SumTree::set(const std::vector<size_t>& leaves, const std::vector<double>& values)
+{
+	std::vector<size_t> nodes(leaves.size());
+
+	for (size_t i(0); i < leaves.size(); ++i) {
+		nodes[i] = mFirstLeaf + leaves[i];
+		mNodes[nodes[i]] = values[i];
+	}
+
+	std::sort(nodes.begin(), nodes.end());
+	nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+
+	// Go up one level at a time, the parents stay sorted so duplicates are adjacent
+	while (!nodes.empty() && nodes[0] > 1) {
+		for (size_t& i : nodes)
+			i /= 2;
+
+		nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+
+		for (size_t i : nodes)
+			mNodes[i] = mNodes[2 * i] + mNodes[2 * i + 1];
+	}
+}
+
+size_t SumTree::find(double value) const
+{
+	size_t i(1);
+
+	while (i < mFirstLeaf) {
+		i *= 2;
+
+		// Never go towards an empty subtree, whatever the rounding errors
+		if (value >= mNodes[i] && mNodes[i + 1] > 0) {
+			value -= mNodes[i];
+			++i;
+		}
+	}
+
+	return i - mFirstLeaf;
+}
+
+void SumTree::sample(const std::vector<double>& uniforms, std::vector<size_t>& leaves) const
+{
+	size_t n(uniforms.size());
+	double segment(total() / n);
+
+	std::vector<double> values(n);
+	leaves.assign(n, 1);
+
+	for (size_t s(0); s < n; ++s)
+		values[s] = (s + uniforms[s]) * segment;
+
+	// All the descents go down together, one level at a time : the children of the next level are prefetched while the others are processed
+	for (size_t level(mFirstLeaf); level > 1; level /= 2) {
+		for (size_t s(0); s < n; ++s) {
+			size_t i(2 * leaves[s]);
+
+			if (values[s] >= mNodes[i] && mNodes[i + 1] > 0) {
+				values[s] -= mNodes[i];
+				++i;
+			}
+
+			leaves[s] = i;
+
+			if (2 * i < mNodes.size())
+				PREFETCH(&mNodes[2 * i]);
+		}
+	}
+
+	for (size_t& i : leaves)
+		i -= mFirstLeaf;
+}
@@ -0,0 +1,51 @@
+#ifndef SUMTREE_H
+#define SUMTREE_H
+
+#include <vector>
+#include <random>
+#include <algorithm>
+
+// Sum tree over a flat array : node 1 is the root, the children of node i are 2i and 2i + 1 and leaf k is the node mFirstLeaf + k
+class SumTree
+{
+public:
+	SumTree(size_t);
+
+	size_t size() const;
+	size_t bytes() const;
+	double total() const;
+
+	double get(size_t) const;
+	void set(size_t, double);
+
+	// Update many leaves, the ancestors they share are only recomputed once
+	void set(const std::vector<size_t>&, const std::vector<double>&);
+
+	// Leaf whose interval of the prefix sums contains the value, leaves with a priority of 0 are never returned
+	size_t find(double) const;
+
+	// Stratified sampling : the i-th leaf is drawn in [i, i + 1) * total() / n, uniforms being the offsets within each segment
+	void sample(const std::vector<double>&, std::vector<size_t>&) const;
+
+	template<class Generator>
+	std::vector<size_t> sample(size_t n, Generator& generator) const
+	{
+		std::uniform_real_distribution<double> distribution(0.0, 1.0);
+		std::vector<double> uniforms(n);
+		std::vector<size_t> leaves;
+
+		for (double& u : uniforms)
+			u = distribution(generator);
+
+		sample(uniforms, leaves);
+
+		return leaves;
+	}
+
+private:
+	size_t mSize;
+	size_t mFirstLeaf;
+	std::vector<double> mNodes;
+};
+
+#endif // SUMTREE_H
@@ -1,146 +1,678 @@
 #include "Tensor3D.h"
 
-Tensor3D::Tensor3D() : Tensor3D(0, 0, 0)
+#include <stdexcept>
+#include <algorithm>
+
+template <typename Scalar>
+BasicTensor3D<Scalar>::BasicTensor3D() : BasicTensor3D(0, 0, 0)
 {
 }
 
-Tensor3D::Tensor3D(const std::vector<Eigen::MatrixXd>& channels) :
-		mChannels(channels)
+template <typename Scalar>
+BasicTensor3D<Scalar>::BasicTensor3D(const std::vector<Matrix>& channels) :
+	BasicTensor3D(channels.empty() ? 0 : channels[0].rows(), channels.empty() ? 0 : channels[0].cols(), channels.size())
 {
+	for (size_t k(0); k < channels.size(); ++k)
+		(*this)[k] = channels[k];
 }
 
 // Weights are given a default value of 0
-Tensor3D::Tensor3D(size_t height, size_t width, size_t depth) :
-	mChannels(depth, Eigen::MatrixXd::Zero(height, width))
+template <typename Scalar>
+BasicTensor3D<Scalar>::BasicTensor3D(size_t height, size_t width, size_t depth, size_t batch) :
+	mHeight(height),
+	mWidth(width),
+	mDepth(depth),
+	mBatch(batch),
+	mData(height * width * depth * batch, 0.0),
+	mView(nullptr)
 {
 }
 
-size_t Tensor3D::width() const
+template <typename Scalar>
+BasicTensor3D<Scalar>::BasicTensor3D(Scalar* data, size_t height, size_t width, size_t depth, size_t batch) :
+	mHeight(height),
+	mWidth(width),
+	mDepth(depth),
+	mBatch(batch),
+	mView(data)
 {
-	if (!depth())
-		return 0;
+}
 
-	return mChannels[0].cols();
+template <typename Scalar>
+BasicTensor3D<Scalar>::BasicTensor3D(const BasicTensor3D& other) :
+	mHeight(other.mHeight),
+	mWidth(other.mWidth),
+	mDepth(other.mDepth),
+	mBatch(other.mBatch),
+	mData(other.data(), other.data() + other.size()),
+	mView(nullptr)
+{
 }
 
-size_t Tensor3D::height() const
+template <typename Scalar>
+BasicTensor3D<Scalar>::BasicTensor3D(BasicTensor3D&& other) noexcept :
+	mHeight(other.mHeight),
+	mWidth(other.mWidth),
+	mDepth(other.mDepth),
+	mBatch(other.mBatch),
+	mData(std::move(other.mData)),
+	mView(other.mView)
 {
-	if (!depth())
-		return 0;
+	if (!mView)
+		other.mHeight = other.mWidth = other.mDepth = other.mBatch = 0;
+}
+
+template <typename Scalar>
+BasicTensor3D<Scalar>& BasicTensor3D<Scalar>::operator=(const BasicTensor3D& other)
+{
+	if (this == &other)
+		return *this;
+
+	if (mView && other.size() != size())
+		throw std::invalid_argument("Tensor3D: a view cannot change its size");
 
-	return mChannels[0].rows();
+	if (mView)
+		std::copy_n(other.data(), size(), mView);
+	else
+		mData.assign(other.data(), other.data() + other.size());
+
+	mHeight = other.mHeight;
+	mWidth = other.mWidth;
+	mDepth = other.mDepth;
+	mBatch = other.mBatch;
+
+	return *this;
 }
 
-size_t Tensor3D::depth() const
+// Views are copied, their memory stays where it is
+template <typename Scalar>
+BasicTensor3D<Scalar>& BasicTensor3D<Scalar>::operator=(BasicTensor3D&& other)
 {
-	return mChannels.size();
+	if (mView || other.mView)
+		return *this = static_cast<const BasicTensor3D&>(other);
+
+	mHeight = other.mHeight;
+	mWidth = other.mWidth;
+	mDepth = other.mDepth;
+	mBatch = other.mBatch;
+	mData = std::move(other.mData);
+
+	other.mHeight = other.mWidth = other.mDepth = other.mBatch = 0;
+
+	return *this;
 }
 
-Eigen::MatrixXd& Tensor3D::operator[](size_t k)
+// Reuses the memory of the tensor when it is large enough, the values are left unspecified
+template <typename Scalar>
+void BasicTensor3D<Scalar>::resize(size_t height, size_t width, size_t depth, size_t batch)
 {
-	return mChannels[k];
+	if (mView && height * width * depth * batch != size())
+		throw std::invalid_argument("Tensor3D: a view cannot change its size");
+
+	mHeight = height;
+	mWidth = width;
+	mDepth = depth;
+	mBatch = batch;
+
+	if (!mView)
+		mData.resize(height * width * depth * batch);
 }
 
-const Eigen::MatrixXd& Tensor3D::operator[](size_t k) const
+template <typename Scalar>
+void BasicTensor3D<Scalar>::reserve(size_t size)
 {
-	return const_cast<Tensor3D*>(this)->operator[](k);
+	if (!mView)
+		mData.reserve(size);
 }
 
-double& Tensor3D::operator()(size_t i, size_t j, size_t k)
+template <typename Scalar>
+void BasicTensor3D<Scalar>::bind(Scalar* data, size_t height, size_t width, size_t depth, size_t batch)
 {
-	return mChannels[k](i, j);
+	mHeight = height;
+	mWidth = width;
+	mDepth = depth;
+	mBatch = batch;
+
+	mData = Buffer();
+	mView = data;
 }
 
-const double& Tensor3D::operator()(size_t i, size_t j, size_t k) const
+template <typename Scalar>
+bool BasicTensor3D<Scalar>::isView() const
 {
-	return const_cast<Tensor3D*>(this)->operator()(i, j, k);
+	return mView != nullptr;
 }
 
-// Assuming all kernels have the same size
-Tensor3D convolution(const Tensor3D& input, const std::vector<Kernel>& kernels, int stride, int padding)
+template <typename Scalar>
+size_t BasicTensor3D<Scalar>::width() const
 {
-	int kernelHeight(kernels[0].weights.height()),
-		kernelWidth(kernels[0].weights.width()),
-		outputHeight((input.height() - kernelHeight + 2 * padding) / stride + 1),
-		outputWidth((input.width() - kernelWidth + 2 * padding) / stride + 1);
+	return mWidth;
+}
 
-	Eigen::MatrixXd inputCols(kernelHeight * kernelWidth * input.depth(), outputHeight * outputWidth);
-	Eigen::MatrixXd weightsRows(kernels.size(), kernelHeight * kernelWidth * input.depth());
+template <typename Scalar>
+size_t BasicTensor3D<Scalar>::height() const
+{
+	return mHeight;
+}
 
-	// Initialize the input matrix
-	for (size_t m(0); m < kernelHeight; ++m) {
-		for (size_t n(0); n < kernelWidth; ++n) {
-			for (size_t c(0); c < input.depth(); ++c) {
-				size_t weightIndex = c * kernelHeight * kernelWidth + n * kernelHeight + m;
+template <typename Scalar>
+size_t BasicTensor3D<Scalar>::depth() const
+{
+	return mDepth;
+}
 
-				for (size_t k(0); k < kernels.size(); ++k)
-					weightsRows(k, weightIndex) = kernels[k].weights(m, n, c);
+template <typename Scalar>
+size_t BasicTensor3D<Scalar>::batch() const
+{
+	return mBatch;
+}
 
-				for (size_t i(0); i < outputHeight; ++i)
-					for (size_t j(0); j < outputWidth; ++j) {
-						int x = stride * i + m - padding, 
-							y = stride * j + n - padding;
+template <typename Scalar>
+size_t BasicTensor3D<Scalar>::size() const
+{
+	return mHeight * mWidth * mDepth * mBatch;
+}
 
-						if (x < 0 || x >= input.height() || y < 0 || y >= input.width())
-							inputCols(weightIndex, j * outputHeight + i) = 0; // Zero-padding
-						else
-							inputCols(weightIndex, j * outputHeight + i) = input(x, y, c);
+template <typename Scalar>
+size_t BasicTensor3D<Scalar>::sampleSize() const
+{
+	return mHeight * mWidth * mDepth;
+}
+
+template <typename Scalar>
+Scalar* BasicTensor3D<Scalar>::data()
+{
+	return mView ? mView : mData.data();
+}
+
+template <typename Scalar>
+const Scalar* BasicTensor3D<Scalar>::data() const
+{
+	return mView ? mView : mData.data();
+}
+
+template <typename Scalar>
+typename BasicTensor3D<Scalar>::ChannelMap BasicTensor3D<Scalar>::operator[](size_t k)
+{
+	return ChannelMap(data() + k * mHeight * mWidth, mHeight, mWidth);
+}
+
+template <typename Scalar>
+typename BasicTensor3D<Scalar>::ConstChannelMap BasicTensor3D<Scalar>::operator[](size_t k) const
+{
+	return ConstChannelMap(data() + k * mHeight * mWidth, mHeight, mWidth);
+}
+
+template <typename Scalar>
+typename BasicTensor3D<Scalar>::MatrixMap BasicTensor3D<Scalar>::matrix()
+{
+	return MatrixMap(data(), mHeight * mWidth, mDepth * mBatch);
+}
+
+template <typename Scalar>
+typename BasicTensor3D<Scalar>::ConstMatrixMap BasicTensor3D<Scalar>::matrix() const
+{
+	return ConstMatrixMap(data(), mHeight * mWidth, mDepth * mBatch);
+}
+
+template <typename Scalar>
+typename BasicTensor3D<Scalar>::VectorMap BasicTensor3D<Scalar>::vector()
+{
+	return VectorMap(data(), size());
+}
+
+template <typename Scalar>
+typename BasicTensor3D<Scalar>::ConstVectorMap BasicTensor3D<Scalar>::vector() const
+{
+	return ConstVectorMap(data(), size());
+}
+
+template <typename Scalar>
+BasicTensor3D<Scalar> BasicTensor3D<Scalar>::sample(size_t p) const
+{
+	BasicTensor3D output(mHeight, mWidth, mDepth);
+	std::copy_n(data() + p * sampleSize(), sampleSize(), output.data());
+
+	return output;
+}
+
+// Copy of the samples first ... first + count - 1
+template <typename Scalar>
+BasicTensor3D<Scalar> BasicTensor3D<Scalar>::samples(size_t first, size_t count) const
+{
+	BasicTensor3D output(mHeight, mWidth, mDepth, count);
+	std::copy_n(data() + first * sampleSize(), count * sampleSize(), output.data());
+
+	return output;
+}
+
+template <typename Scalar>
+void BasicTensor3D<Scalar>::setSample(size_t p, const BasicTensor3D& input)
+{
+	std::copy_n(input.data(), sampleSize(), data() + p * sampleSize());
+}
+
+template <typename Scalar>
+Scalar& BasicTensor3D<Scalar>::operator()(size_t i, size_t j, size_t k, size_t p)
+{
+	return data()[((p * mDepth + k) * mWidth + j) * mHeight + i];
+}
+
+template <typename Scalar>
+const Scalar& BasicTensor3D<Scalar>::operator()(size_t i, size_t j, size_t k, size_t p) const
+{
+	return const_cast<BasicTensor3D*>(this)->operator()(i, j, k, p);
+}
+
+// One column per kernel, each kernel being a contiguous sample of the weights tensor
+template <typename Scalar>
+static Eigen::Map<const typename BasicTensor3D<Scalar>::Matrix> weightsMatrix(const BasicTensor3D<Scalar>& weights)
+{
+	return Eigen::Map<const typename BasicTensor3D<Scalar>::Matrix>(weights.data(), weights.sampleSize(), weights.batch());
+}
+
+// Unroll the receptive fields of the whole batch into inputRows : one row per output position, one column per weight
+// inputRows is a column-major (batch * outputHeight * outputWidth) x (kernelHeight * kernelWidth * depth) matrix, whose columns are written in order
+// With Rectify, the ReLU of the input is unrolled instead, without any copy of the input
+// Any stride, every position being checked against the borders : see im2col below for the specialized versions
+template <bool Rectify, typename Scalar>
+static void im2colStrided(const BasicTensor3D<Scalar>& input, int kernelHeight, int kernelWidth, int stride, int padding, int outputHeight, int outputWidth, Scalar* inputRows)
+{
+	Scalar* col(inputRows);
+
+	for (size_t c(0); c < input.depth(); ++c) {
+		for (int n(0); n < kernelWidth; ++n) {
+			for (int m(0); m < kernelHeight; ++m) {
+				for (size_t p(0); p < input.batch(); ++p) {
+					const Scalar* channel(input.data() + (p * input.depth() + c) * input.height() * input.width());
+
+					for (int j(0); j < outputWidth; ++j) {
+						for (int i(0); i < outputHeight; ++i) {
+							int x = stride * i + m - padding,
+								y = stride * j + n - padding;
+
+							if (x < 0 || x >= int(input.height()) || y < 0 || y >= int(input.width()))
+								*col++ = 0; // Zero-padding
+							else if (Rectify)
+								*col++ = std::max(channel[y * input.height() + x], Scalar(0));
+							else
+								*col++ = channel[y * input.height() + x];
+						}
 					}
+				}
 			}
 		}
 	}
+}
 
-	// Compute the matrix product
-	Eigen::MatrixXd outputMatrix(weightsRows * inputCols); // dimensions : kernels.size() x (outputHeight * outputWidth)
+// Inverse of im2col : scatter-add the rows back into the batch
+// With Masked, nothing is added where mask (laid out like input) is <= 0, which multiplies the result by the derivative of ReLU
+template <bool Masked, typename Scalar>
+static void col2imStrided(const typename BasicTensor3D<Scalar>::Matrix& inputRows, int kernelHeight, int kernelWidth, int stride, int padding, int outputHeight, int outputWidth, const Scalar* mask, BasicTensor3D<Scalar>& input)
+{
+	for (size_t c(0); c < input.depth(); ++c) {
+		for (int n(0); n < kernelWidth; ++n) {
+			for (int m(0); m < kernelHeight; ++m) {
+				const Scalar* col(inputRows.col(c * kernelHeight * kernelWidth + n * kernelHeight + m).data());
 
-	Tensor3D output(outputHeight, outputWidth, kernels.size());
+				for (size_t p(0); p < input.batch(); ++p) {
+					size_t channelOffset((p * input.depth() + c) * input.height() * input.width());
+					Scalar* channel(input.data() + channelOffset);
 
-	for (size_t i(0); i < outputHeight; ++i)
-		for (size_t j(0); j < outputWidth; ++j)
-			for (size_t k(0); k < kernels.size(); ++k)
-				output(i, j, k) = outputMatrix(k, j * outputHeight + i) + kernels[k].bias;
+					for (int j(0); j < outputWidth; ++j) {
+						for (int i(0); i < outputHeight; ++i, ++col) {
+							int x = stride * i + m - padding,
+								y = stride * j + n - padding;
 
-	return output;
+							if (x < 0 || x >= int(input.height()) || y < 0 || y >= int(input.width()))
+								continue;
+
+							if (Masked && mask[channelOffset + y * input.height() + x] <= 0)
+								continue;
+
+							channel[y * input.height() + x] += *col;
+						}
+					}
+				}
+			}
+		}
+	}
 }
 
-Tensor3D deconvolution(const Tensor3D& output, const std::vector<Kernel>& kernels, int stride, int padding)
+// im2col with a stride of 1 : along a column of the output, consecutive positions read consecutive positions of the input
+// Each run of outputHeight values is a contiguous copy between two blocks of zero-padding, whose bounds are computed once per run
+// A kernel size of 0 is given at run time, any other is known at compile time and the loops over the kernel positions unroll
+template <int KernelHeight, int KernelWidth, bool Rectify, typename Scalar>
+static void im2colUnitStride(const BasicTensor3D<Scalar>& input, int kernelHeight, int kernelWidth, int padding, int outputHeight, int outputWidth, Scalar* inputRows)
 {
-	int kernelHeight(kernels[0].weights.height()),
-		kernelWidth(kernels[0].weights.width()),
-		kernelDepth(kernels[0].weights.depth()),
-		inputHeight(stride * (output.height() - 1) + kernelHeight - 2 * padding),
-		intputWidth(stride * (output.width() - 1) + kernelWidth - 2 * padding);
+	const int height(input.height()), width(input.width()),
+			  kHeight(KernelHeight ? KernelHeight : kernelHeight),
+			  kWidth(KernelWidth ? KernelWidth : kernelWidth);
+
+	Scalar* col(inputRows);
 
-	Tensor3D input(inputHeight, inputHeight, kernelDepth);
+	for (size_t c(0); c < input.depth(); ++c) {
+		for (int n(0); n < kWidth; ++n) {
+			for (int m(0); m < kHeight; ++m) {
+				// Output rows [first, last) read input rows [first + m - padding, last + m - padding), all inside the input
+				int first(std::min(std::max(padding - m, 0), outputHeight)),
+					last(std::max(std::min(height + padding - m, outputHeight), first));
 
-	for (size_t k(0); k < kernels.size(); ++k) {
-		for (size_t i(0); i < output.height(); ++i) {
-			for (size_t j(0); j < output.width(); ++j) {
-				for (size_t m(0); m < kernelHeight; ++m) {
-					for (size_t n(0); n < kernelWidth; ++n) {
-						int x = i * stride + m - padding, 
-							y = j * stride + n - padding;
+				for (size_t p(0); p < input.batch(); ++p) {
+					const Scalar* channel(input.data() + (p * input.depth() + c) * height * width);
 
-						if (x < 0 || x >= input.height() || y < 0 || y >= input.width())
+					// Without padding, a 1x1 kernel reads the whole channel in order
+					if (KernelHeight == 1 && KernelWidth == 1 && !padding) {
+						if (Rectify)
+							for (int i(0); i < height * width; ++i)
+								*col++ = std::max(channel[i], Scalar(0));
+						else
+							col = std::copy(channel, channel + height * width, col);
+
+						continue;
+					}
+
+					for (int j(0); j < outputWidth; ++j) {
+						int y(j + n - padding);
+
+						if (y < 0 || y >= width) {
+							col = std::fill_n(col, outputHeight, Scalar(0));
 							continue;
+						}
+
+						const Scalar* source(channel + y * height + first + m - padding);
 
-						for (size_t c(0); c < kernelDepth; ++c)
-							input(x, y, c) += kernels[k].weights(m, n, c) * output(i, j, k);
+						col = std::fill_n(col, first, Scalar(0));
+
+						if (Rectify)
+							for (int i(first); i < last; ++i)
+								*col++ = std::max(*source++, Scalar(0));
+						else
+							col = std::copy(source, source + (last - first), col);
+
+						col = std::fill_n(col, outputHeight - last, Scalar(0));
 					}
 				}
 			}
 		}
 	}
+}
+
+// Inverse of im2colUnitStride, each run being added to a contiguous range of the input
+template <int KernelHeight, int KernelWidth, bool Masked, typename Scalar>
+static void col2imUnitStride(const typename BasicTensor3D<Scalar>::Matrix& inputRows, int kernelHeight, int kernelWidth, int padding, int outputHeight, int outputWidth, const Scalar* mask, BasicTensor3D<Scalar>& input)
+{
+	const int height(input.height()), width(input.width()),
+			  kHeight(KernelHeight ? KernelHeight : kernelHeight),
+			  kWidth(KernelWidth ? KernelWidth : kernelWidth);
+
+	for (size_t c(0); c < input.depth(); ++c) {
+		for (int n(0); n < kWidth; ++n) {
+			for (int m(0); m < kHeight; ++m) {
+				const Scalar* col(inputRows.col(c * kHeight * kWidth + n * kHeight + m).data());
+
+				int first(std::min(std::max(padding - m, 0), outputHeight)),
+					last(std::max(std::min(height + padding - m, outputHeight), first));
+
+				for (size_t p(0); p < input.batch(); ++p) {
+					size_t channelOffset((p * input.depth() + c) * height * width);
+
+					for (int j(0); j < outputWidth; ++j, col += outputHeight) {
+						int y(j + n - padding);
+
+						if (y < 0 || y >= width)
+							continue;
+
+						size_t offset(channelOffset + y * height + first + m - padding);
+						Scalar* target(input.data() + offset);
+
+						for (int i(first); i < last; ++i, ++target)
+							if (!Masked || mask[offset + i - first] > 0)
+								*target += col[i];
+					}
+				}
+			}
+		}
+	}
+}
+
+// Picks the unrolling for the shape of the kernels : the 3x3 and 4x4 kernels of the network and the pointwise ones have their own instances
+template <bool Rectify, typename Scalar>
+static void im2col(const BasicTensor3D<Scalar>& input, int kernelHeight, int kernelWidth, int stride, int padding, int outputHeight, int outputWidth, Scalar* inputRows)
+{
+	if (stride != 1)
+		im2colStrided<Rectify>(input, kernelHeight, kernelWidth, stride, padding, outputHeight, outputWidth, inputRows);
+	else if (kernelHeight == 1 && kernelWidth == 1)
+		im2colUnitStride<1, 1, Rectify>(input, 1, 1, padding, outputHeight, outputWidth, inputRows);
+	else if (kernelHeight == 3 && kernelWidth == 3)
+		im2colUnitStride<3, 3, Rectify>(input, 3, 3, padding, outputHeight, outputWidth, inputRows);
+	else if (kernelHeight == 4 && kernelWidth == 4)
+		im2colUnitStride<4, 4, Rectify>(input, 4, 4, padding, outputHeight, outputWidth, inputRows);
+	else
+		im2colUnitStride<0, 0, Rectify>(input, kernelHeight, kernelWidth, padding, outputHeight, outputWidth, inputRows);
+}
+
+template <bool Masked, typename Scalar>
+static void col2im(const typename BasicTensor3D<Scalar>::Matrix& inputRows, int kernelHeight, int kernelWidth, int stride, int padding, int outputHeight, int outputWidth, const Scalar* mask, BasicTensor3D<Scalar>& input)
+{
+	if (stride != 1)
+		col2imStrided<Masked>(inputRows, kernelHeight, kernelWidth, stride, padding, outputHeight, outputWidth, mask, input);
+	else if (kernelHeight == 1 && kernelWidth == 1)
+		col2imUnitStride<1, 1, Masked>(inputRows, 1, 1, padding, outputHeight, outputWidth, mask, input);
+	else if (kernelHeight == 3 && kernelWidth == 3)
+		col2imUnitStride<3, 3, Masked>(inputRows, 3, 3, padding, outputHeight, outputWidth, mask, input);
+	else if (kernelHeight == 4 && kernelWidth == 4)
+		col2imUnitStride<4, 4, Masked>(inputRows, 4, 4, padding, outputHeight, outputWidth, mask, input);
+	else
+		col2imUnitStride<0, 0, Masked>(inputRows, kernelHeight, kernelWidth, padding, outputHeight, outputWidth, mask, input);
+}
+
+// One row per position and one column per channel, the samples being stacked vertically
+template <typename Scalar>
+static typename BasicTensor3D<Scalar>::Matrix toRows(const BasicTensor3D<Scalar>& tensor)
+{
+	typedef typename BasicTensor3D<Scalar>::Matrix Matrix;
+
+	size_t size(tensor.height() * tensor.width());
+	Matrix rows(tensor.batch() * size, tensor.depth());
+
+	for (size_t p(0); p < tensor.batch(); ++p)
+		rows.middleRows(p * size, size) = Eigen::Map<const Matrix>(tensor.data() + p * tensor.sampleSize(), size, tensor.depth());
+
+	return rows;
+}
+
+// 1x1 kernels with a stride of 1 and no padding : each sample, as a positions x channels matrix, is multiplied by the weights straight into the output
+// On a 1x1 map the batch is a single channels x batch matrix, and the layer a single product (a matrix-vector one for a single sample)
+// Nothing is unrolled, the input is only copied into columns to apply the ReLU
+template <bool Rectify, typename Scalar>
+static void pointwise(const BasicTensor3D<Scalar>& input, const BasicTensor3D<Scalar>& weights, const typename BasicTensor3D<Scalar>::ConstVectorRef& biases,
+					  BasicTensor3D<Scalar>& output, typename BasicTensor3D<Scalar>::Buffer& columns)
+{
+	typedef typename BasicTensor3D<Scalar>::Matrix Matrix;
+
+	const Scalar* source(input.data());
+
+	if (Rectify) {
+		columns.resize(input.size());
+		Eigen::Map<typename BasicTensor3D<Scalar>::Vector>(columns.data(), input.size()) = input.vector().cwiseMax(Scalar(0));
+		source = columns.data();
+	}
+
+	size_t positions(input.height() * input.width());
+
+	output.resize(input.height(), input.width(), weights.batch(), input.batch());
+
+	if (positions == 1) {
+		Eigen::Map<Matrix> outputColumns(output.data(), weights.batch(), input.batch());
+
+		outputColumns.noalias() = weightsMatrix(weights).transpose() * Eigen::Map<const Matrix>(source, input.depth(), input.batch());
+		outputColumns.colwise() += biases;
+		return;
+	}
+
+	for (size_t p(0); p < input.batch(); ++p) {
+		Eigen::Map<Matrix> outputRows(output.data() + p * output.sampleSize(), positions, weights.batch());
+
+		outputRows.noalias() = Eigen::Map<const Matrix>(source + p * input.sampleSize(), positions, input.depth()) * weightsMatrix(weights);
+		outputRows.rowwise() += biases.transpose();
+	}
+}
+
+// Assuming all kernels have the same size
+// 1x1 kernels may go through pointwise, any other layer is unrolled by im2col and multiplied by the weights
+// The output and the buffers keep their memory from one call to the next, and the biases are added while the product is written back into the output
+template <bool Rectify, typename Scalar>
+static void convolve(const BasicTensor3D<Scalar>& input, const BasicTensor3D<Scalar>& weights, const typename BasicTensor3D<Scalar>::ConstVectorRef& biases, int stride, int padding,
+					 BasicTensor3D<Scalar>& output, typename BasicTensor3D<Scalar>::Buffer& columns, typename BasicTensor3D<Scalar>::Buffer& products)
+{
+	typedef typename BasicTensor3D<Scalar>::Matrix Matrix;
+
+	int kernelHeight(weights.height()),
+		kernelWidth(weights.width()),
+		outputHeight((input.height() - kernelHeight + 2 * padding) / stride + 1),
+		outputWidth((input.width() - kernelWidth + 2 * padding) / stride + 1);
+
+	// A batch of larger maps through many kernels is better off with a single product over the unrolled rows, the unrolling being a plain copy for 1x1 kernels
+	// With few kernels that product is too narrow to pay for the copies, and the products by sample are faster
+	if (kernelHeight == 1 && kernelWidth == 1 && stride == 1 && padding == 0 && (input.batch() == 1 || outputHeight * outputWidth == 1 || weights.batch() < 16)) {
+		pointwise<Rectify>(input, weights, biases, output, columns);
+		return;
+	}
+
+	size_t outputSize(outputHeight * outputWidth),
+		   rows(input.batch() * outputSize);
+
+	columns.resize(rows * weights.sampleSize());
+	products.resize(rows * weights.batch());
+
+	im2col<Rectify>(input, kernelHeight, kernelWidth, stride, padding, outputHeight, outputWidth, columns.data());
+
+	// Compute the matrix product
+	Eigen::Map<Matrix> inputRows(columns.data(), rows, weights.sampleSize()),
+					   outputRows(products.data(), rows, weights.batch()); // dimensions : (batch * outputHeight * outputWidth) x kernels
+
+	outputRows.noalias() = inputRows * weightsMatrix(weights);
+
+	output.resize(outputHeight, outputWidth, weights.batch(), input.batch());
+
+	for (size_t p(0); p < input.batch(); ++p)
+		for (size_t k(0); k < weights.batch(); ++k)
+			output.matrix().col(p * weights.batch() + k) = outputRows.col(k).segment(p * outputSize, outputSize).array() + biases(k);
+}
+
+template <typename Scalar>
+BasicTensor3D<Scalar> convolution(const BasicTensor3D<Scalar>& input, const BasicTensor3D<Scalar>& weights, const typename BasicTensor3D<Scalar>::ConstVectorRef& biases, int stride, int padding)
+{
+	BasicTensor3D<Scalar> output;
+	typename BasicTensor3D<Scalar>::Buffer columns, products;
+
+	convolve<false>(input, weights, biases, stride, padding, output, columns, products);
+
+	return output;
+}
+
+// Same as convolution(relu(input), ...), the ReLU being applied while unrolling the input
+template <typename Scalar>
+BasicTensor3D<Scalar> reluConvolution(const BasicTensor3D<Scalar>& input, const BasicTensor3D<Scalar>& weights, const typename BasicTensor3D<Scalar>::ConstVectorRef& biases, int stride, int padding)
+{
+	BasicTensor3D<Scalar> output;
+	typename BasicTensor3D<Scalar>::Buffer columns, products;
+
+	convolve<true>(input, weights, biases, stride, padding, output, columns, products);
+
+	return output;
+}
+
+// Allocates nothing once output and the buffers are large enough
+template <typename Scalar>
+void reluConvolution(const BasicTensor3D<Scalar>& input, const BasicTensor3D<Scalar>& weights, const typename BasicTensor3D<Scalar>::ConstVectorRef& biases, int stride, int padding,
+					 BasicTensor3D<Scalar>& output, typename BasicTensor3D<Scalar>::Buffer& columns, typename BasicTensor3D<Scalar>::Buffer& products)
+{
+	convolve<true>(input, weights, biases, stride, padding, output, columns, products);
+}
+
+// Transposed convolution : a single matrix product followed by col2im
+template <typename Scalar>
+BasicTensor3D<Scalar> deconvolution(const BasicTensor3D<Scalar>& output, const BasicTensor3D<Scalar>& weights, int stride, int padding)
+{
+	int kernelHeight(weights.height()),
+		kernelWidth(weights.width()),
+		inputHeight(stride * (output.height() - 1) + kernelHeight - 2 * padding),
+		inputWidth(stride * (output.width() - 1) + kernelWidth - 2 * padding);
+
+	typename BasicTensor3D<Scalar>::Matrix inputRows(toRows(output) * weightsMatrix(weights).transpose()); // dimensions : (batch * outputHeight * outputWidth) x (kernelHeight * kernelWidth * kernelDepth)
+
+	BasicTensor3D<Scalar> input(inputHeight, inputWidth, weights.depth(), output.batch());
+	col2im<false>(inputRows, kernelHeight, kernelWidth, stride, padding, output.height(), output.width(), static_cast<const Scalar*>(nullptr), input);
 
 	return input;
 }
 
-Tensor3D relu(const Tensor3D& input)
+// Gradients of a convolution with respect to its kernels, summed over the batch
+// They are written in place : weightsGradient is laid out like the weights tensor, biasesGradient holds one value per kernel
+template <typename Scalar>
+void kernelsGradient(const BasicTensor3D<Scalar>& input, const BasicTensor3D<Scalar>& outputDeltas, int kernelHeight, int kernelWidth, int stride, int padding, Scalar* weightsGradient, Scalar* biasesGradient)
 {
-	Tensor3D output(input);
+	typedef typename BasicTensor3D<Scalar>::Matrix Matrix;
+	typedef typename BasicTensor3D<Scalar>::Vector Vector;
+
+	Matrix inputRows(outputDeltas.batch() * outputDeltas.height() * outputDeltas.width(), kernelHeight * kernelWidth * input.depth());
+	im2col<false>(input, kernelHeight, kernelWidth, stride, padding, outputDeltas.height(), outputDeltas.width(), inputRows.data());
+
+	Matrix deltaRows(toRows(outputDeltas));
 
-	for (size_t i(0); i < output.depth(); ++i)
-		output[i] = output[i].cwiseMax(0);
+	Eigen::Map<Matrix>(weightsGradient, kernelHeight * kernelWidth * input.depth(), outputDeltas.depth()).noalias() = inputRows.transpose() * deltaRows;
+	Eigen::Map<Vector>(biasesGradient, outputDeltas.depth()) = deltaRows.colwise().sum().transpose();
+}
+
+// Backward pass of reluConvolution : kernels gradients as kernelsGradient(relu(input), ...) and, unless inputDeltas is null,
+// the deltas of the input already multiplied by the derivative of the ReLU
+// The deltas are unrolled once for both products, and neither the ReLU of the input nor its mask is ever stored
+template <typename Scalar>
+void reluConvolutionBackward(const BasicTensor3D<Scalar>& input, const BasicTensor3D<Scalar>& outputDeltas, const BasicTensor3D<Scalar>& weights, int stride, int padding, Scalar* weightsGradient, Scalar* biasesGradient, BasicTensor3D<Scalar>* inputDeltas)
+{
+	typedef typename BasicTensor3D<Scalar>::Matrix Matrix;
+	typedef typename BasicTensor3D<Scalar>::Vector Vector;
+
+	int kernelHeight(weights.height()),
+		kernelWidth(weights.width());
+
+	Matrix inputRows(outputDeltas.batch() * outputDeltas.height() * outputDeltas.width(), kernelHeight * kernelWidth * input.depth());
+	im2col<true>(input, kernelHeight, kernelWidth, stride, padding, outputDeltas.height(), outputDeltas.width(), inputRows.data());
+
+	Matrix deltaRows(toRows(outputDeltas));
+
+	Eigen::Map<Matrix>(weightsGradient, kernelHeight * kernelWidth * input.depth(), outputDeltas.depth()).noalias() = inputRows.transpose() * deltaRows;
+	Eigen::Map<Vector>(biasesGradient, outputDeltas.depth()) = deltaRows.colwise().sum().transpose();
+
+	if (!inputDeltas)
+		return;
+
+	inputRows.noalias() = deltaRows * weightsMatrix(weights).transpose();
+
+	*inputDeltas = BasicTensor3D<Scalar>(input.height(), input.width(), input.depth(), input.batch());
+	col2im<true>(inputRows, kernelHeight, kernelWidth, stride, padding, outputDeltas.height(), outputDeltas.width(), input.data(), *inputDeltas);
+}
+
+template <typename Scalar>
+BasicTensor3D<Scalar> relu(const BasicTensor3D<Scalar>& input)
+{
+	BasicTensor3D<Scalar> output(input);
+	output.vector() = output.vector().cwiseMax(Scalar(0));
 
 	return output;
 }
+
+#define INSTANTIATE_TENSOR3D(Scalar) \
+	template class BasicTensor3D<Scalar>; \
+	template BasicTensor3D<Scalar> convolution(const BasicTensor3D<Scalar>&, const BasicTensor3D<Scalar>&, const BasicTensor3D<Scalar>::ConstVectorRef&, int, int); \
+	template BasicTensor3D<Scalar> reluConvolution(const BasicTensor3D<Scalar>&, const BasicTensor3D<Scalar>&, const BasicTensor3D<Scalar>::ConstVectorRef&, int, int); \
+	template void reluConvolution(const BasicTensor3D<Scalar>&, const BasicTensor3D<Scalar>&, const BasicTensor3D<Scalar>::ConstVectorRef&, int, int, BasicTensor3D<Scalar>&, BasicTensor3D<Scalar>::Buffer&, BasicTensor3D<Scalar>::Buffer&); \
+	template BasicTensor3D<Scalar> deconvolution(const BasicTensor3D<Scalar>&, const BasicTensor3D<Scalar>&, int, int); \
+	template void kernelsGradient(const BasicTensor3D<Scalar>&, const BasicTensor3D<Scalar>&, int, int, int, int, Scalar*, Scalar*); \
+	template void reluConvolutionBackward(const BasicTensor3D<Scalar>&, const BasicTensor3D<Scalar>&, const BasicTensor3D<Scalar>&, int, int, Scalar*, Scalar*, BasicTensor3D<Scalar>*); \
+	template BasicTensor3D<Scalar> relu(const BasicTensor3D<Scalar>&);
+
+INSTANTIATE_TENSOR3D(float)
+INSTANTIATE_TENSOR3D(double)
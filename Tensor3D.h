@@ -6,47 +6,107 @@
 #include <algorithm>
 #include <Eigen\Dense>
 
-struct Kernel;
-
-class Tensor3D
+// Batch of height x width x depth tensors stored in a single aligned buffer (NCHW order)
+// Each channel is a column-major height x width matrix, channels of a sample are contiguous and samples follow each other
+// A tensor can also be a view of memory it does not own, such as the parameters of a network : a view is never reallocated,
+// assigning to it writes into that memory, a copy of it owns its data and moving it gives a view of the same memory
+// Instantiated for float and double in Tensor3D.cpp
+template <typename Scalar>
+class BasicTensor3D
 {
 public:
-	Tensor3D();
-	Tensor3D(const std::vector<Eigen::MatrixXd>&);
-	Tensor3D(size_t, size_t, size_t);
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+	typedef std::vector<Scalar, Eigen::aligned_allocator<Scalar>> Buffer;
+
+	typedef Eigen::Map<Matrix> ChannelMap;
+	typedef Eigen::Map<const Matrix> ConstChannelMap;
+	typedef Eigen::Map<Matrix, Eigen::Aligned16> MatrixMap;
+	typedef Eigen::Map<const Matrix, Eigen::Aligned16> ConstMatrixMap;
+	typedef Eigen::Map<Vector, Eigen::Aligned16> VectorMap;
+	typedef Eigen::Map<const Vector, Eigen::Aligned16> ConstVectorMap;
+	typedef Eigen::Ref<const Vector> ConstVectorRef;
+
+	BasicTensor3D();
+	BasicTensor3D(const std::vector<Matrix>&);
+	BasicTensor3D(size_t, size_t, size_t, size_t = 1);
+	BasicTensor3D(Scalar*, size_t, size_t, size_t, size_t = 1); // View, the memory must be aligned on 16 bytes
+
+	BasicTensor3D(const BasicTensor3D&);
+	BasicTensor3D(BasicTensor3D&&) noexcept;
+	BasicTensor3D& operator=(const BasicTensor3D&);
+	BasicTensor3D& operator=(BasicTensor3D&&);
+
+	// A view can only be reshaped to the same size
+	void resize(size_t, size_t, size_t, size_t = 1);
+	void reserve(size_t);
+
+	// Turn the tensor into a view of other memory, whatever it was
+	void bind(Scalar*, size_t, size_t, size_t, size_t = 1);
+	bool isView() const;
 
 	size_t width() const;
 	size_t height() const;
 	size_t depth() const;
+	size_t batch() const;
+
+	size_t size() const;
+	size_t sampleSize() const;
+
+	Scalar* data();
+	const Scalar* data() const;
 
-	Eigen::MatrixXd& operator[](size_t);
-	const Eigen::MatrixXd& operator[](size_t) const;
+	// Channels of all the samples, the channel k of the sample p is at index p * depth() + k
+	ChannelMap operator[](size_t);
+	ConstChannelMap operator[](size_t) const;
 
-	double& operator()(size_t, size_t, size_t);
-	const double& operator()(size_t, size_t, size_t) const;
+	// (height * width) x (depth * batch) view, one column per channel
+	MatrixMap matrix();
+	ConstMatrixMap matrix() const;
+
+	// Flat view of the whole buffer
+	VectorMap vector();
+	ConstVectorMap vector() const;
+
+	BasicTensor3D sample(size_t) const;
+	BasicTensor3D samples(size_t, size_t) const;
+	void setSample(size_t, const BasicTensor3D&);
+
+	Scalar& operator()(size_t, size_t, size_t, size_t = 0);
+	const Scalar& operator()(size_t, size_t, size_t, size_t = 0) const;
 
 private:
-	std::vector<Eigen::MatrixXd> mChannels;
+	size_t mHeight, mWidth, mDepth, mBatch;
+	Buffer mData;
+	Scalar* mView; // Memory of a view, nullptr if the tensor owns mData
 };
 
-struct Kernel
-{
-	Kernel(const Tensor3D& w, double b) : 
-		weights(w), 
-		bias(b), 
-		weightsAvgGrad(weights.height(), weights.width(), weights.depth()),
-		biasAvgGrad(0.0)
-	{ }
-
-	Tensor3D weights;
-	double bias;
-
-	Tensor3D weightsAvgGrad;
-	double biasAvgGrad;
-};
+// Kernels are stored in a single tensor : weights has one sample per kernel
+template <typename Scalar>
+BasicTensor3D<Scalar> convolution(const BasicTensor3D<Scalar>&, const BasicTensor3D<Scalar>&, const typename BasicTensor3D<Scalar>::ConstVectorRef&, int, int);
+template <typename Scalar>
+BasicTensor3D<Scalar> deconvolution(const BasicTensor3D<Scalar>&, const BasicTensor3D<Scalar>&, int, int);
+template <typename Scalar>
+void kernelsGradient(const BasicTensor3D<Scalar>&, const BasicTensor3D<Scalar>&, int, int, int, int, Scalar*, Scalar*);
+template <typename Scalar>
+BasicTensor3D<Scalar> relu(const BasicTensor3D<Scalar>&);
+
+// Layers of the network : ReLU fused with the convolution, and its backward pass
+template <typename Scalar>
+BasicTensor3D<Scalar> reluConvolution(const BasicTensor3D<Scalar>&, const BasicTensor3D<Scalar>&, const typename BasicTensor3D<Scalar>::ConstVectorRef&, int, int);
+template <typename Scalar>
+void reluConvolution(const BasicTensor3D<Scalar>&, const BasicTensor3D<Scalar>&, const typename BasicTensor3D<Scalar>::ConstVectorRef&, int, int,
+					 BasicTensor3D<Scalar>&, typename BasicTensor3D<Scalar>::Buffer&, typename BasicTensor3D<Scalar>::Buffer&);
+template <typename Scalar>
+void reluConvolutionBackward(const BasicTensor3D<Scalar>&, const BasicTensor3D<Scalar>&, const BasicTensor3D<Scalar>&, int, int, Scalar*, Scalar*, BasicTensor3D<Scalar>*);
+
+// Scalar type of the networks and of the states, float unless SNAKE_DOUBLE is defined
+#ifdef SNAKE_DOUBLE
+typedef double Real;
+#else
+typedef float Real;
+#endif
 
-Tensor3D convolution(const Tensor3D&, const std::vector<Kernel>&, int, int);
-Tensor3D deconvolution(const Tensor3D&, const std::vector<Kernel>&, int, int);
-Tensor3D relu(const Tensor3D&);
+typedef BasicTensor3D<Real> Tensor3D;
 
 #endif // TENSOR3D_H
@@ -0,0 +1,98 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(size_t nbThreads) :
+	mTask(nullptr),
+	mNbTasks(0),
+	mNextTask(0),
+	mRemainingTasks(0),
+	mJob(0),
+	mActiveWorkers(0),
+	mStop(false)
+{
+	for (size_t i(1); i < nbThreads; ++i)
+		mWorkers.emplace_back(&ThreadPool::_work, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+
+	mJobStarted.notify_all();
+
+	for (std::thread& worker : mWorkers)
+		worker.join();
+}
+
+size_t ThreadPool::size() const
+{
+	return mWorkers.size() + 1;
+}
+
+// No worker is left in _execute when this returns, so the next job can safely replace the task
+void ThreadPool::run(size_t nbTasks, const std::function<void(size_t)>& task)
+{
+	if (!nbTasks)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		mTask = &task;
+		mNbTasks = nbTasks;
+		mNextTask = 0;
+		mRemainingTasks = nbTasks;
+		++mJob;
+	}
+
+	if (nbTasks > 1)
+		mJobStarted.notify_all();
+
+	_execute();
+
+	std::unique_lock<std::mutex> lock(mMutex);
+	mJobFinished.wait(lock, [this]() { return !mRemainingTasks && !mActiveWorkers; });
+}
+
+void ThreadPool::_work()
+{
+	size_t lastJob(0);
+	std::unique_lock<std::mutex> lock(mMutex);
+
+	while (true) {
+		mJobStarted.wait(lock, [&]() { return mStop || mJob != lastJob; });
+
+		if (mStop)
+			return;
+
+		lastJob = mJob;
+
+		// Every task is taken already, joining late could overlap with the next job
+		if (mNextTask >= mNbTasks)
+			continue;
+
+		++mActiveWorkers;
+		lock.unlock();
+
+		_execute();
+
+		lock.lock();
+
+		if (!--mActiveWorkers)
+			mJobFinished.notify_all();
+	}
+}
+
+void ThreadPool::_execute()
+{
+	for (size_t i(mNextTask++); i < mNbTasks; i = mNextTask++) {
+		(*mTask)(i);
+
+		if (!--mRemainingTasks) {
+			std::lock_guard<std::mutex> lock(mMutex);
+			mJobFinished.notify_all();
+		}
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+// Fixed set of threads running the tasks of one job at a time, the calling thread working too
+// Tasks are handed out through an atomic counter, so a job only locks to start and to finish
+class ThreadPool
+{
+public:
+	ThreadPool(size_t);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Number of threads, the calling thread included
+	size_t size() const;
+
+	// Call task(0) ... task(nbTasks - 1) and return once they are all done
+	void run(size_t, const std::function<void(size_t)>&);
+
+private:
+	void _work();
+	void _execute();
+
+	std::vector<std::thread> mWorkers;
+
+	const std::function<void(size_t)>* mTask;
+	size_t mNbTasks;
+	std::atomic<size_t> mNextTask;
+	std::atomic<size_t> mRemainingTasks;
+
+	size_t mJob; // Incremented for every job, so that the workers know when a new one starts
+	size_t mActiveWorkers;
+	bool mStop;
+
+	std::mutex mMutex;
+	std::condition_variable mJobStarted, mJobFinished;
+};
+
+#endif // THREADPOOL_H
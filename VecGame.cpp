@@ -0,0 +1,258 @@
+#include "VecGame.h"
+
+#include <stdexcept>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// What happened to a game during the first pass of a step
+enum StepEvent : int32_t { Dead = 1, Eat = 2, Grow = 4 };
+
+static int popcount(uint64_t x)
+{
+#ifdef _MSC_VER
+	return int(__popcnt64(x));
+#else
+	return __builtin_popcountll(x);
+#endif
+}
+
+static int lowestBit(uint64_t x)
+{
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward64(&i, x);
+	return int(i);
+#else
+	return __builtin_ctzll(x);
+#endif
+}
+
+// Index of the k-th set bit of x, skipping whole bytes first
+static int selectBit(uint64_t x, int k)
+{
+	int offset(0);
+
+	for (int c(popcount(x & 0xFF)); k >= c; c = popcount(x & 0xFF)) {
+		k -= c;
+		x >>= 8;
+		offset += 8;
+	}
+
+	for (; k; --k)
+		x &= x - 1;
+
+	return offset + lowestBit(x);
+}
+
+// First pass of VecGame::step : move the heads and test them against the bitboards, on integers only and without any branch or gather so that it vectorizes
+// The arrays are parameters so that they can be declared not to alias, GCC -O3 vectorizes it with AVX2 (x86-64-v3) but not with SSE2 which has no per-lane shifts of 64-bit words
+static void moveHeads(size_t nbGames, int32_t gridSize, const Direction* __restrict actions,
+					  uint64_t* __restrict bodyLo, uint64_t* __restrict bodyHi, const uint64_t* __restrict appleLo, const uint64_t* __restrict appleHi,
+					  int32_t* __restrict headX, int32_t* __restrict headY, int32_t* __restrict direction, const int32_t* __restrict tailCell,
+					  int32_t* __restrict nbApples, int32_t* __restrict newCell, int32_t* __restrict events)
+{
+	for (size_t g(0); g < nbGames; ++g) {
+		int32_t d(direction[g]),
+				x(headX[g] + (d == Down) - (d == Up)),
+				y(headY[g] + (d == Right) - (d == Left));
+
+		x += gridSize * ((x < 0) - (x >= gridSize));
+		y += gridSize * ((y < 0) - (y >= gridSize));
+
+		int32_t cell(x * gridSize + y),
+				tail(tailCell[g]);
+
+		uint64_t headLo(uint64_t(cell < 64) << (cell & 63)),
+				 headHi(uint64_t(cell >= 64) << (cell & 63)),
+				 tailLo(uint64_t(tail < 64) << (tail & 63)),
+				 tailHi(uint64_t(tail >= 64) << (tail & 63));
+
+		// The tail leaves its cell unless the snake grows
+		int32_t grow(nbApples[g] > 0);
+		uint64_t keepTail(0 - uint64_t(grow)),
+				 movedLo(bodyLo[g] & ~(tailLo & ~keepTail)),
+				 movedHi(bodyHi[g] & ~(tailHi & ~keepTail));
+
+		int32_t dead(((movedLo & headLo) | (movedHi & headHi)) != 0),
+				eat(((appleLo[g] & headLo) | (appleHi[g] & headHi)) != 0),
+				isActive(actions[g] != None); // A game given None does not move
+
+		uint64_t active(0 - uint64_t(isActive));
+		int32_t active32(0 - isActive);
+
+		bodyLo[g] = ((movedLo | headLo) & active) | (bodyLo[g] & ~active);
+		bodyHi[g] = ((movedHi | headHi) & active) | (bodyHi[g] & ~active);
+
+		headX[g] = (x & active32) | (headX[g] & ~active32);
+		headY[g] = (y & active32) | (headY[g] & ~active32);
+		direction[g] = (int32_t(actions[g]) & active32) | (d & ~active32);
+
+		nbApples[g] += (isActive & ~dead & eat) - (isActive & grow);
+		newCell[g] = (cell & active32) | ~active32;
+		events[g] = active32 & (dead * Dead | eat * Eat | grow * Grow);
+	}
+}
+
+VecGame::VecGame(size_t nbGames, int gridSize, const Random& random) :
+	mNbGames(nbGames),
+	mGridSize(gridSize),
+	mNbCells(gridSize * gridSize),
+	mBodyLo(nbGames), mBodyHi(nbGames),
+	mAppleLo(nbGames), mAppleHi(nbGames),
+	mHeadX(nbGames), mHeadY(nbGames),
+	mDirection(nbGames),
+	mBody(nbGames * gridSize * gridSize),
+	mTail(nbGames),
+	mTailCell(nbGames),
+	mLength(nbGames),
+	mNbApples(nbGames),
+	mScore(nbGames),
+	mFinalScore(nbGames),
+	mNewCell(nbGames),
+	mEvents(nbGames),
+	mRandom(random)
+{
+	if (mNbCells > 128)
+		throw std::invalid_argument("VecGame: the grid does not fit in a 128-bit bitboard");
+
+	initialize();
+}
+
+void VecGame::initialize()
+{
+	for (size_t g(0); g < mNbGames; ++g)
+		reset(g);
+}
+
+void VecGame::reset(size_t g)
+{
+	mHeadX[g] = int32_t(mRandom.uniform(size_t(mGridSize)));
+	mHeadY[g] = int32_t(mRandom.uniform(size_t(mGridSize)));
+
+	int cell(mHeadX[g] * mGridSize + mHeadY[g]);
+
+	mBodyLo[g] = uint64_t(cell < 64) << (cell & 63);
+	mBodyHi[g] = uint64_t(cell >= 64) << (cell & 63);
+
+	mBody[g * mNbCells] = cell;
+	mTail[g] = 0;
+	mTailCell[g] = cell;
+	mLength[g] = 1;
+
+	mDirection[g] = Right;
+	mNbApples[g] = 0;
+	mScore[g] = 0.;
+
+	_generateApple(g);
+}
+
+void VecGame::step(const Direction* actions, double* rewards, bool* isTerminal)
+{
+	moveHeads(mNbGames, mGridSize, actions, mBodyLo.data(), mBodyHi.data(), mAppleLo.data(), mAppleHi.data(), mHeadX.data(), mHeadY.data(),
+			  mDirection.data(), mTailCell.data(), mNbApples.data(), mNewCell.data(), mEvents.data());
+
+	// Rewards, ring buffers, apples and restarts : O(1) per game
+	for (size_t g(0); g < mNbGames; ++g) {
+		bool dead(mEvents[g] & Dead), eat(mEvents[g] & Eat);
+
+		rewards[g] = dead ? -1.0 : double(eat);
+		isTerminal[g] = dead;
+
+		if (mNewCell[g] < 0)
+			continue;
+
+		if (dead) {
+			mFinalScore[g] = mScore[g];
+			reset(g);
+			continue;
+		}
+
+		mScore[g] += double(eat);
+
+		if (mEvents[g] & Grow)
+			++mLength[g];
+		else
+			mTail[g] = (mTail[g] + 1) % mNbCells;
+
+		mBody[g * mNbCells + (mTail[g] + mLength[g] - 1) % mNbCells] = mNewCell[g];
+		mTailCell[g] = mBody[g * mNbCells + mTail[g]];
+
+		if (mEvents[g] & Grow)
+			_generateApple(g);
+	}
+}
+
+void VecGame::state(Tensor3D& states) const
+{
+	if (states.height() != size_t(mGridSize) || states.width() != size_t(mGridSize) || states.depth() != 1 || states.batch() != mNbGames)
+		states = Tensor3D(mGridSize, mGridSize, 1, mNbGames);
+
+	for (size_t g(0); g < mNbGames; ++g)
+		state(g, states.data() + g * states.sampleSize());
+}
+
+void VecGame::state(size_t g, Real* state) const
+{
+	Tensor3D::ChannelMap channel(state, mGridSize, mGridSize);
+	channel.setZero();
+
+	// Same recentering as Game::state
+	int shiftX(int(mGridSize * 1.5) - mHeadX[g]),
+		shiftY(int(mGridSize * 1.5) - mHeadY[g]);
+
+	if (mAppleLo[g] | mAppleHi[g]) {
+		int apple(mAppleLo[g] ? lowestBit(mAppleLo[g]) : 64 + lowestBit(mAppleHi[g]));
+		channel((apple / mGridSize + shiftX) % mGridSize, (apple % mGridSize + shiftY) % mGridSize) = 0.299;
+	}
+
+	for (int32_t i(0); i < mLength[g]; ++i) {
+		int cell(mBody[g * mNbCells + (mTail[g] + i) % mNbCells]);
+		channel((cell / mGridSize + shiftX) % mGridSize, (cell % mGridSize + shiftY) % mGridSize) = 1.0;
+	}
+}
+
+size_t VecGame::games() const
+{
+	return mNbGames;
+}
+
+int VecGame::gridSize() const
+{
+	return mGridSize;
+}
+
+double VecGame::score(size_t g) const
+{
+	return mScore[g];
+}
+
+double VecGame::finalScore(size_t g) const
+{
+	return mFinalScore[g];
+}
+
+// Pick uniformly one of the free cells, there is no apple anymore if the snake fills the grid
+void VecGame::_generateApple(size_t g)
+{
+	uint64_t validLo(mNbCells >= 64 ? ~uint64_t(0) : (uint64_t(1) << mNbCells) - 1),
+			 validHi(mNbCells > 64 ? (uint64_t(1) << (mNbCells - 64)) - 1 : 0),
+			 freeLo(~mBodyLo[g] & validLo),
+			 freeHi(~mBodyHi[g] & validHi);
+
+	int nbFreeLo(popcount(freeLo)),
+		nbFree(nbFreeLo + popcount(freeHi));
+
+	mAppleLo[g] = mAppleHi[g] = 0;
+
+	if (!nbFree)
+		return;
+
+	int k(int(mRandom.uniform(size_t(nbFree))));
+
+	if (k < nbFreeLo)
+		mAppleLo[g] = uint64_t(1) << selectBit(freeLo, k);
+	else
+		mAppleHi[g] = uint64_t(1) << selectBit(freeHi, k - nbFreeLo);
+}
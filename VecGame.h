@@ -0,0 +1,62 @@
+#ifndef VECGAME_H
+#define VECGAME_H
+
+#include <cstdint>
+#include <vector>
+#include "Game.h"
+
+// Many games stepped together, stored as structure of arrays
+// The grid of every game is a 128-bit bitboard (two 64-bit words), the cell (x, y) being the bit x * gridSize + y, so gridSize can be at most 11
+// Rules are the same as Game : the grid wraps around and a move takes effect on the following step
+class VecGame
+{
+public:
+	VecGame(size_t, int, const Random& = Random());
+
+	void initialize();
+	void reset(size_t);
+
+	// Games that end during a step are restarted right away, their score is kept in finalScore()
+	void step(const Direction*, double*, bool*);
+
+	// Head-centered states of all the games, one sample per game
+	void state(Tensor3D&) const;
+	void state(size_t, Real*) const; // State of one game, gridSize * gridSize values as a sample of a Tensor3D
+
+	size_t games() const;
+	int gridSize() const;
+
+	double score(size_t) const;
+	double finalScore(size_t) const;
+
+private:
+	void _generateApple(size_t);
+
+	size_t mNbGames;
+	int mGridSize;
+	int mNbCells;
+
+	std::vector<uint64_t> mBodyLo, mBodyHi;
+	std::vector<uint64_t> mAppleLo, mAppleHi;
+
+	std::vector<int32_t> mHeadX, mHeadY;
+	std::vector<int32_t> mDirection; // Move applied on the next step
+
+	// Ring buffer of the body cells of each game, from the tail to the head
+	std::vector<uint8_t> mBody;
+	std::vector<int32_t> mTail;
+	std::vector<int32_t> mTailCell; // mBody at mTail, so that the first pass of step() does not gather from the ring buffers
+	std::vector<int32_t> mLength;
+	std::vector<int32_t> mNbApples;
+
+	std::vector<double> mScore;
+	std::vector<double> mFinalScore;
+
+	// Scratch arrays of step()
+	std::vector<int32_t> mNewCell;
+	std::vector<int32_t> mEvents;
+
+	Random mRandom;
+};
+
+#endif // VECGAME_H
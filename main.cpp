@@ -1,7 +1,49 @@
 #include "Agent.h"
+#include "Benchmark.h"
 
-int main()
+#include <cstdlib>
+
+// "benchmark [max log2 of the replay memory size]" writes the benchmark results as JSON lines instead of training
+// "scaling [grid sizes...]" writes the scaling benchmarks of the given grid sizes, by default 10, 20, 32 and 64
+// "evaluate [weights] [games] [threads] [grid size]" plays greedy games with a checkpoint and writes the report as a JSON line
+// The grid size is the one the checkpoint was trained on, 10 by default : the layers of the agents depend on it, and other checkpoints are rejected
+// The SNAKE_SEED environment variable sets the seed of the run, otherwise it is random and the training prints it
+int main(int argc, char* argv[])
 {
+	if (const char* seed = std::getenv("SNAKE_SEED"))
+		Random::setSeed(std::stoull(seed));
+
+	if (argc > 1 && std::string(argv[1]) == "benchmark") {
+		runBenchmarks(std::cout, argc > 2 ? std::stoul(argv[2]) : 24);
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "scaling") {
+		std::vector<size_t> gridSizes;
+
+		for (int i(2); i < argc; ++i)
+			gridSizes.push_back(std::stoul(argv[i]));
+
+		if (gridSizes.empty())
+			runScalingBenchmarks(std::cout);
+		else
+			runScalingBenchmarks(std::cout, gridSizes);
+
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "evaluate") {
+		Agent agent(argc > 5 ? std::stoul(argv[5]) : PolicyNetwork::inputHeight);
+		EvaluationSettings settings;
+
+		agent.loadFromFile(argc > 2 ? argv[2] : "weights.bin");
+		settings.nbGames = argc > 3 ? std::stoul(argv[3]) : settings.nbGames;
+		settings.nbThreads = argc > 4 ? std::stoul(argv[4]) : settings.nbThreads;
+
+		agent.evaluate(settings).print(std::cout);
+		return 0;
+	}
+
 	Agent agent;
 	agent.train(-1, 16, 262144, 0.99, 1.0, 0.01, 0.0005, 0.00025, 0.95, 1e-8);
 